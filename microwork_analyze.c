@@ -0,0 +1,749 @@
+/*****************************************************************************
+ *
+ * microwork_analyze.c
+ *
+ * Offline analyzer for binary timing logs written by microwork_log.c.
+ *
+ * The log is mmapped and split into one contiguous chunk per analysis
+ * thread. Two passes are made over the records:
+ *
+ *   1. reductions: error moments overall, per kernel, per cpu and per
+ *      duration bucket, plus the TSC range covered by the log
+ *   2. distributions: error histograms for the same groups, the error
+ *      time series, and outliers relative to their duration bucket
+ *
+ * Per-thread results are merged and written as JSON.
+ *
+ * Error is (end_tsc - start_tsc) / tsc_per_nsec - target_nsec, i.e.,
+ * positive values are overshoot.
+ *
+ *****************************************************************************/
+
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "microwork_inline_work.h"
+#include "microwork_log.h"
+
+/* records processed per vectorized block */
+#define BLOCK 1024
+
+/* cpu numbers are taken from IA32_TSC_AUX, so at most 12 bits */
+#define MAX_CPUS 4096
+
+/* duration buckets are powers of two of target_nsec */
+#define NUM_BUCKETS 48
+
+/* signed log-scale error histogram: HIST_OCTAVES octaves of magnitude,
+   each split into HIST_SUB bins, on either side of a bin for |err| < 1 ns */
+#define HIST_OCTAVES 48
+#define HIST_SUB 8
+#define HIST_HALF (HIST_OCTAVES * HIST_SUB)
+#define HIST_BINS (2 * HIST_HALF + 1)
+
+/* most outliers kept per analysis thread for clustering */
+#define MAX_OUTLIERS (1 << 20)
+
+/* clusters written to the output */
+#define MAX_CLUSTERS 32
+
+/* runtime options */
+typedef struct an_opts_s {
+  char *log_path;
+  char *out_path;       /* NULL for stdout */
+  int num_threads;
+  int num_windows;      /* time series windows */
+  double sigma;         /* outlier threshold in bucket standard deviations */
+  double cluster_nsec;  /* outliers closer than this belong to one cluster */
+} an_opts_t;
+
+/* error moments */
+typedef struct moments_s {
+  uint64_t n;
+  double sum;
+  double sumsq;
+  double sum_rel;       /* sum of |err| / target_nsec */
+  double min;
+  double max;
+} moments_t;
+
+/* one outlier */
+typedef struct outlier_s {
+  uint64_t tsc;
+  double err;
+  uint32_t cpu;
+} outlier_t;
+
+/* per-thread state */
+typedef struct an_thread_s {
+  pthread_t tid;
+  const mw_record_t *records;
+  uint64_t num_records;
+  const an_opts_t *opts;
+  double nsec_per_tsc;
+
+  /* pass 1 */
+  moments_t all;
+  moments_t kernel[KERNEL_COUNT + 1];
+  moments_t bucket[NUM_BUCKETS];
+  moments_t *cpu;       /* MAX_CPUS */
+  uint64_t min_tsc;
+  uint64_t max_tsc;
+  uint32_t max_cpu;
+
+  /* pass 2 inputs, shared */
+  const moments_t *g_bucket;
+  uint64_t g_min_tsc;
+  double window_tsc;
+  uint32_t num_cpus;
+
+  /* pass 2 */
+  uint64_t *h_all;      /* HIST_BINS */
+  uint64_t *h_kernel;   /* (KERNEL_COUNT + 1) x HIST_BINS */
+  uint64_t *h_bucket;   /* NUM_BUCKETS x HIST_BINS */
+  uint64_t *h_cpu;      /* num_cpus x HIST_BINS */
+  uint64_t *w_count;    /* num_windows */
+  double *w_sum;
+  double *w_abs;
+  outlier_t *outliers;
+  uint64_t num_outliers;
+  uint64_t max_outliers;
+  uint64_t outliers_lost;
+} an_thread_t;
+
+/* outlier cluster */
+typedef struct cluster_s {
+  uint64_t start_tsc;
+  uint64_t end_tsc;
+  uint64_t count;
+  double sum_err;
+  double max_err;
+  uint32_t first_cpu;
+  int multi_cpu;
+} cluster_t;
+
+static const char *kernel_names[] = WORK_KERNEL_NAMES;
+
+/*******************************************************************
+ * HELPERS
+ *******************************************************************/
+
+static void moments_init(moments_t *m) {
+  memset(m, 0, sizeof(*m));
+  m->min = DBL_MAX;
+  m->max = -DBL_MAX;
+}
+
+static void moments_add(moments_t *m, double err, double rel) {
+  m->n++;
+  m->sum += err;
+  m->sumsq += err * err;
+  m->sum_rel += rel;
+  if (err < m->min) m->min = err;
+  if (err > m->max) m->max = err;
+}
+
+static void moments_merge(moments_t *into, const moments_t *from) {
+  into->n += from->n;
+  into->sum += from->sum;
+  into->sumsq += from->sumsq;
+  into->sum_rel += from->sum_rel;
+  if (from->min < into->min) into->min = from->min;
+  if (from->max > into->max) into->max = from->max;
+}
+
+static double moments_mean(const moments_t *m) {
+  return m->n ? m->sum / m->n : 0.0;
+}
+
+static double moments_std(const moments_t *m) {
+  double mean, v;
+  if (m->n == 0) return 0.0;
+  mean = m->sum / m->n;
+  v = m->sumsq / m->n - mean * mean;
+  return v > 0.0 ? sqrt(v) : 0.0;
+}
+
+/* duration bucket of a target: floor(log2(target_nsec)) */
+static int bucket_of(uint64_t target_nsec) {
+  int b = target_nsec ? 63 - __builtin_clzll(target_nsec) : 0;
+  return b < NUM_BUCKETS ? b : NUM_BUCKETS - 1;
+}
+
+static int kernel_of(uint16_t kernel) {
+  return kernel < KERNEL_COUNT ? kernel : KERNEL_COUNT;
+}
+
+/* histogram bin of a signed error */
+static int hist_bin(double err) {
+  double a = fabs(err), m;
+  int e, idx;
+
+  if (a < 1.0) return HIST_HALF;
+  m = frexp(a, &e);                 /* a = m * 2^e, m in [0.5, 1) */
+  idx = (e - 1) * HIST_SUB + (int)((2.0 * m - 1.0) * HIST_SUB);
+  if (idx >= HIST_HALF) idx = HIST_HALF - 1;
+  return err < 0 ? HIST_HALF - 1 - idx : HIST_HALF + 1 + idx;
+}
+
+/* value range [lo, hi) covered by a histogram bin */
+static void hist_range(int bin, double *lo, double *hi) {
+  int idx, o, s;
+  double l, h;
+
+  if (bin == HIST_HALF) {
+    *lo = -1.0;
+    *hi = 1.0;
+    return;
+  }
+  idx = bin > HIST_HALF ? bin - HIST_HALF - 1 : HIST_HALF - 1 - bin;
+  o = idx / HIST_SUB;
+  s = idx % HIST_SUB;
+  l = ldexp(1.0 + s / (double)HIST_SUB, o);
+  h = ldexp(1.0 + (s + 1) / (double)HIST_SUB, o);
+  if (bin > HIST_HALF) {
+    *lo = l;
+    *hi = h;
+  } else {
+    *lo = -h;
+    *hi = -l;
+  }
+}
+
+/*
+ * Quantile q (0..1) of the bins [first, last] of a histogram,
+ * interpolating linearly within the bin.
+ */
+static double hist_quantile(const uint64_t *h, int first, int last, double q) {
+  uint64_t total = 0, cum = 0;
+  double target, lo, hi;
+  int b;
+
+  for (b = first; b <= last; b++) total += h[b];
+  if (total == 0) return 0.0;
+  target = q * total;
+  for (b = first; b <= last; b++) {
+    if (h[b] && cum + h[b] >= target) {
+      hist_range(b, &lo, &hi);
+      return lo + (hi - lo) * ((target - cum) / h[b]);
+    }
+    cum += h[b];
+  }
+  hist_range(last, &lo, &hi);
+  return hi;
+}
+
+static double elapsed_sec(struct timespec *a, struct timespec *b) {
+  return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/*******************************************************************
+ * PASSES
+ *******************************************************************/
+
+/* errors (nsec) and relative errors for a block of records */
+static void block_errors(const mw_record_t *r, int n, double nsec_per_tsc, double *err, double *rel) {
+  int i;
+
+  #pragma omp simd
+  for (i = 0; i < n; i++) {
+    double target = (double)r[i].target_nsec;
+    err[i] = (double)(int64_t)(r[i].end_tsc - r[i].start_tsc) * nsec_per_tsc - target;
+    rel[i] = target > 0.0 ? fabs(err[i]) / target : 0.0;
+  }
+}
+
+static void *pass1(void *arg) {
+  an_thread_t *th = (an_thread_t *)arg;
+  double err[BLOCK], rel[BLOCK];
+  uint64_t i;
+  int j, n;
+
+  for (i = 0; i < th->num_records; i += BLOCK) {
+    const mw_record_t *r = th->records + i;
+    double sum = 0.0, sumsq = 0.0, sum_rel = 0.0;
+    double mn = DBL_MAX, mx = -DBL_MAX;
+    uint64_t tmin = th->min_tsc, tmax = th->max_tsc;
+    uint32_t cmax = th->max_cpu;
+
+    n = (th->num_records - i) < BLOCK ? (int)(th->num_records - i) : BLOCK;
+    block_errors(r, n, th->nsec_per_tsc, err, rel);
+
+    /* whole-log reductions */
+    #pragma omp simd reduction(+:sum,sumsq,sum_rel) reduction(min:mn,tmin) reduction(max:mx,tmax,cmax)
+    for (j = 0; j < n; j++) {
+      sum += err[j];
+      sumsq += err[j] * err[j];
+      sum_rel += rel[j];
+      mn = err[j] < mn ? err[j] : mn;
+      mx = err[j] > mx ? err[j] : mx;
+      tmin = r[j].start_tsc < tmin ? r[j].start_tsc : tmin;
+      tmax = r[j].start_tsc > tmax ? r[j].start_tsc : tmax;
+      cmax = r[j].cpu > cmax ? r[j].cpu : cmax;
+    }
+    th->all.n += n;
+    th->all.sum += sum;
+    th->all.sumsq += sumsq;
+    th->all.sum_rel += sum_rel;
+    if (mn < th->all.min) th->all.min = mn;
+    if (mx > th->all.max) th->all.max = mx;
+    th->min_tsc = tmin;
+    th->max_tsc = tmax;
+    th->max_cpu = cmax;
+
+    /* grouped reductions */
+    for (j = 0; j < n; j++) {
+      moments_add(&th->kernel[kernel_of(r[j].kernel)], err[j], rel[j]);
+      moments_add(&th->bucket[bucket_of(r[j].target_nsec)], err[j], rel[j]);
+      moments_add(&th->cpu[r[j].cpu % MAX_CPUS], err[j], rel[j]);
+    }
+  }
+  return NULL;
+}
+
+static void *pass2(void *arg) {
+  an_thread_t *th = (an_thread_t *)arg;
+  const an_opts_t *opts = th->opts;
+  double err[BLOCK], rel[BLOCK];
+  uint64_t i;
+  int j, n, b, bin, w;
+
+  for (i = 0; i < th->num_records; i += BLOCK) {
+    const mw_record_t *r = th->records + i;
+
+    n = (th->num_records - i) < BLOCK ? (int)(th->num_records - i) : BLOCK;
+    block_errors(r, n, th->nsec_per_tsc, err, rel);
+
+    for (j = 0; j < n; j++) {
+      const moments_t *bm;
+      double dev;
+
+      bin = hist_bin(err[j]);
+      b = bucket_of(r[j].target_nsec);
+      th->h_all[bin]++;
+      th->h_kernel[kernel_of(r[j].kernel) * HIST_BINS + bin]++;
+      th->h_bucket[b * HIST_BINS + bin]++;
+      if (r[j].cpu < th->num_cpus) th->h_cpu[r[j].cpu * HIST_BINS + bin]++;
+
+      w = (int)((r[j].start_tsc - th->g_min_tsc) / th->window_tsc);
+      if (w >= opts->num_windows) w = opts->num_windows - 1;
+      th->w_count[w]++;
+      th->w_sum[w] += err[j];
+      th->w_abs[w] += fabs(err[j]);
+
+      /* outliers relative to the record's duration bucket */
+      bm = &th->g_bucket[b];
+      dev = moments_std(bm);
+      if (bm->n > 1 && fabs(err[j] - moments_mean(bm)) > opts->sigma * dev) {
+        if (th->num_outliers == th->max_outliers && th->max_outliers < MAX_OUTLIERS) {
+          outlier_t *grown = (outlier_t *)realloc(th->outliers, 2 * th->max_outliers * sizeof(outlier_t));
+          if (grown != NULL) {
+            th->outliers = grown;
+            th->max_outliers *= 2;
+          }
+        }
+        if (th->num_outliers < th->max_outliers) {
+          th->outliers[th->num_outliers].tsc = r[j].start_tsc;
+          th->outliers[th->num_outliers].err = err[j];
+          th->outliers[th->num_outliers].cpu = r[j].cpu;
+          th->num_outliers++;
+        } else {
+          th->outliers_lost++;
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+static int outlier_cmp(const void *a, const void *b) {
+  const outlier_t *x = (const outlier_t *)a, *y = (const outlier_t *)b;
+  return x->tsc < y->tsc ? -1 : x->tsc > y->tsc;
+}
+
+static int cluster_cmp(const void *a, const void *b) {
+  const cluster_t *x = (const cluster_t *)a, *y = (const cluster_t *)b;
+  return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+/*******************************************************************
+ * OUTPUT
+ *******************************************************************/
+
+static void write_stats(FILE *out, const moments_t *m, const uint64_t *h) {
+  uint64_t over = 0;
+  int b;
+
+  for (b = HIST_HALF + 1; b < HIST_BINS; b++) over += h[b];
+  fprintf(out, "\"count\": %llu, \"mean_err_nsec\": %.3f, \"std_err_nsec\": %.3f, ",
+      (unsigned long long)m->n, moments_mean(m), moments_std(m));
+  fprintf(out, "\"min_err_nsec\": %.3f, \"max_err_nsec\": %.3f, \"mean_abs_rel_err\": %.6f, ",
+      m->n ? m->min : 0.0, m->n ? m->max : 0.0, m->n ? m->sum_rel / m->n : 0.0);
+  fprintf(out, "\"err_quantiles_nsec\": {\"p1\": %.1f, \"p10\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f}, ",
+      hist_quantile(h, 0, HIST_BINS - 1, 0.01), hist_quantile(h, 0, HIST_BINS - 1, 0.10),
+      hist_quantile(h, 0, HIST_BINS - 1, 0.50), hist_quantile(h, 0, HIST_BINS - 1, 0.90),
+      hist_quantile(h, 0, HIST_BINS - 1, 0.99));
+  fprintf(out, "\"overshoot\": {\"fraction\": %.6f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"p9999\": %.1f}",
+      m->n ? over / (double)m->n : 0.0,
+      hist_quantile(h, HIST_HALF + 1, HIST_BINS - 1, 0.50), hist_quantile(h, HIST_HALF + 1, HIST_BINS - 1, 0.90),
+      hist_quantile(h, HIST_HALF + 1, HIST_BINS - 1, 0.99), hist_quantile(h, HIST_HALF + 1, HIST_BINS - 1, 0.999),
+      hist_quantile(h, HIST_HALF + 1, HIST_BINS - 1, 0.9999));
+}
+
+/*******************************************************************
+ * COMMAND LINE
+ *******************************************************************/
+
+void usage(char **argv) {
+  printf("\n################################################################\n");
+  printf("Usage:\n");
+  printf("  %s -f <log> [-o <json>] [-j <threads>] [-w <windows>] [-k <sigma>] [-g <nsecs>]\n", argv[0]);
+  printf("\nWhere:\n");
+  printf("  -f <log>     : binary timing log written with -l (required)\n");
+  printf("  -o <json>    : output file (optional; default stdout)\n");
+  printf("  -j <threads> : analysis threads (optional; default online cpus)\n");
+  printf("  -w <windows> : time series windows (optional; default 100)\n");
+  printf("  -k <sigma>   : outlier threshold in standard deviations of the duration bucket (optional; default 4)\n");
+  printf("  -g <nsecs>   : outliers closer than this form one cluster (optional; default 1000000)\n");
+  printf("################################################################");
+  printf("\n");
+  exit(-1);
+}
+
+int process_args(int argc, char **argv, an_opts_t *opts) {
+  int c;
+  extern char *optarg;
+
+  opts->log_path = NULL;
+  opts->out_path = NULL;
+  opts->num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  opts->num_windows = 100;
+  opts->sigma = 4.0;
+  opts->cluster_nsec = 1000000.0;
+
+  while ((c = getopt(argc, argv, "f:g:j:k:o:w:")) != -1) {
+    switch (c) {
+      case 'f': opts->log_path = optarg; break;
+      case 'g': opts->cluster_nsec = atof(optarg); break;
+      case 'j': opts->num_threads = atoi(optarg); break;
+      case 'k': opts->sigma = atof(optarg); break;
+      case 'o': opts->out_path = optarg; break;
+      case 'w': opts->num_windows = atoi(optarg); break;
+      default: usage(argv);
+    }
+  }
+  if (opts->log_path == NULL) {
+    fprintf(stderr, "\n-f option required\n");
+    usage(argv);
+  }
+  if (opts->num_threads < 1) opts->num_threads = 1;
+  if (opts->num_windows < 1) opts->num_windows = 1;
+  return 0;
+}
+
+/*
+ * Mr. Main
+ */
+int main(int argc, char **argv) {
+  an_opts_t opts;
+  struct stat st;
+  struct timespec t_start, t_end;
+  const mw_log_header_t *header;
+  const mw_record_t *records;
+  const mw_log_ring_t *rings;
+  an_thread_t *th;
+  moments_t all, kernel[KERNEL_COUNT + 1], bucket[NUM_BUCKETS], *cpu;
+  uint64_t *h_all, *h_kernel, *h_bucket, *h_cpu, *w_count;
+  double *w_sum, *w_abs;
+  uint64_t num_records, per, min_tsc, max_tsc, num_outliers = 0, outliers_lost = 0;
+  double nsec_per_tsc, window_tsc;
+  uint32_t num_cpus = 0;
+  outlier_t *outliers;
+  cluster_t *clusters;
+  uint64_t num_clusters = 0;
+  FILE *out = stdout;
+  void *map;
+  int fd, t, i, b, nt;
+
+  process_args(argc, argv, &opts);
+  clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+  /* map the log */
+  fd = open(opts.log_path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "%s:%d: ERROR -- could not open %s.\n", __FILE__, __LINE__, opts.log_path);
+    return -1;
+  }
+  if ((size_t)st.st_size < sizeof(mw_log_header_t)) {
+    fprintf(stderr, "%s:%d: ERROR -- %s is too short to be a timing log.\n", __FILE__, __LINE__, opts.log_path);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "%s:%d: ERROR -- could not map %s.\n", __FILE__, __LINE__, opts.log_path);
+    return -1;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  header = (const mw_log_header_t *)map;
+  if (memcmp(header->magic, MW_LOG_MAGIC, sizeof(header->magic)) != 0 || header->record_size != sizeof(mw_record_t)) {
+    fprintf(stderr, "%s:%d: ERROR -- %s is not a version %d timing log.\n", __FILE__, __LINE__, opts.log_path, MW_LOG_VERSION);
+    return -1;
+  }
+  if (header->tsc_per_nsec <= 0.0) {
+    fprintf(stderr, "%s:%d: ERROR -- %s has no TSC rate (log not closed?).\n", __FILE__, __LINE__, opts.log_path);
+    return -1;
+  }
+  num_records = header->num_records;
+  if (sizeof(*header) + num_records * sizeof(mw_record_t) + header->num_rings * sizeof(mw_log_ring_t) > (uint64_t)st.st_size) {
+    fprintf(stderr, "%s:%d: ERROR -- %s is truncated.\n", __FILE__, __LINE__, opts.log_path);
+    return -1;
+  }
+  records = (const mw_record_t *)(header + 1);
+  rings = (const mw_log_ring_t *)(records + num_records);
+  nsec_per_tsc = 1.0 / header->tsc_per_nsec;
+
+  /* one contiguous chunk of records per thread */
+  nt = opts.num_threads;
+  if ((uint64_t)nt > num_records / BLOCK + 1) nt = (int)(num_records / BLOCK + 1);
+  th = (an_thread_t *)calloc(nt, sizeof(*th));
+  per = (num_records + nt - 1) / nt;
+  for (t = 0; t < nt; t++) {
+    uint64_t first = t * per;
+    th[t].records = records + (first < num_records ? first : num_records);
+    th[t].num_records = first < num_records ? (num_records - first < per ? num_records - first : per) : 0;
+    th[t].opts = &opts;
+    th[t].nsec_per_tsc = nsec_per_tsc;
+    th[t].cpu = (moments_t *)malloc(MAX_CPUS * sizeof(moments_t));
+    moments_init(&th[t].all);
+    for (i = 0; i <= KERNEL_COUNT; i++) moments_init(&th[t].kernel[i]);
+    for (i = 0; i < NUM_BUCKETS; i++) moments_init(&th[t].bucket[i]);
+    for (i = 0; i < MAX_CPUS; i++) moments_init(&th[t].cpu[i]);
+    th[t].min_tsc = UINT64_MAX;
+    th[t].max_tsc = 0;
+    th[t].max_cpu = 0;
+  }
+
+  /* pass 1 */
+  for (t = 0; t < nt; t++) pthread_create(&th[t].tid, NULL, pass1, &th[t]);
+  for (t = 0; t < nt; t++) pthread_join(th[t].tid, NULL);
+
+  moments_init(&all);
+  for (i = 0; i <= KERNEL_COUNT; i++) moments_init(&kernel[i]);
+  for (i = 0; i < NUM_BUCKETS; i++) moments_init(&bucket[i]);
+  cpu = (moments_t *)malloc(MAX_CPUS * sizeof(moments_t));
+  for (i = 0; i < MAX_CPUS; i++) moments_init(&cpu[i]);
+  min_tsc = UINT64_MAX;
+  max_tsc = 0;
+  for (t = 0; t < nt; t++) {
+    moments_merge(&all, &th[t].all);
+    for (i = 0; i <= KERNEL_COUNT; i++) moments_merge(&kernel[i], &th[t].kernel[i]);
+    for (i = 0; i < NUM_BUCKETS; i++) moments_merge(&bucket[i], &th[t].bucket[i]);
+    for (i = 0; i < MAX_CPUS; i++) moments_merge(&cpu[i], &th[t].cpu[i]);
+    if (th[t].num_records == 0) continue;
+    if (th[t].min_tsc < min_tsc) min_tsc = th[t].min_tsc;
+    if (th[t].max_tsc > max_tsc) max_tsc = th[t].max_tsc;
+    if (th[t].max_cpu + 1 > num_cpus) num_cpus = th[t].max_cpu + 1;
+  }
+  if (num_cpus > MAX_CPUS) num_cpus = MAX_CPUS;
+  if (min_tsc > max_tsc) min_tsc = max_tsc;
+  window_tsc = (max_tsc - min_tsc + 1) / (double)opts.num_windows;
+
+  /* pass 2 */
+  for (t = 0; t < nt; t++) {
+    th[t].g_bucket = bucket;
+    th[t].g_min_tsc = min_tsc;
+    th[t].window_tsc = window_tsc;
+    th[t].num_cpus = num_cpus;
+    th[t].h_all = (uint64_t *)calloc(HIST_BINS, sizeof(uint64_t));
+    th[t].h_kernel = (uint64_t *)calloc((KERNEL_COUNT + 1) * HIST_BINS, sizeof(uint64_t));
+    th[t].h_bucket = (uint64_t *)calloc(NUM_BUCKETS * HIST_BINS, sizeof(uint64_t));
+    th[t].h_cpu = (uint64_t *)calloc((size_t)num_cpus * HIST_BINS, sizeof(uint64_t));
+    th[t].w_count = (uint64_t *)calloc(opts.num_windows, sizeof(uint64_t));
+    th[t].w_sum = (double *)calloc(opts.num_windows, sizeof(double));
+    th[t].w_abs = (double *)calloc(opts.num_windows, sizeof(double));
+    th[t].max_outliers = 4096;
+    th[t].outliers = (outlier_t *)malloc(th[t].max_outliers * sizeof(outlier_t));
+    if (!th[t].h_all || !th[t].h_kernel || !th[t].h_bucket || !th[t].h_cpu ||
+        !th[t].w_count || !th[t].w_sum || !th[t].w_abs || !th[t].outliers) {
+      fprintf(stderr, "%s:%d: ERROR -- failure allocating analysis buffers.\n", __FILE__, __LINE__);
+      return -1;
+    }
+  }
+  for (t = 0; t < nt; t++) pthread_create(&th[t].tid, NULL, pass2, &th[t]);
+  for (t = 0; t < nt; t++) pthread_join(th[t].tid, NULL);
+
+  /* merge pass 2 into thread 0 */
+  h_all = th[0].h_all;
+  h_kernel = th[0].h_kernel;
+  h_bucket = th[0].h_bucket;
+  h_cpu = th[0].h_cpu;
+  w_count = th[0].w_count;
+  w_sum = th[0].w_sum;
+  w_abs = th[0].w_abs;
+  for (t = 1; t < nt; t++) {
+    for (i = 0; i < HIST_BINS; i++) h_all[i] += th[t].h_all[i];
+    for (i = 0; i < (KERNEL_COUNT + 1) * HIST_BINS; i++) h_kernel[i] += th[t].h_kernel[i];
+    for (i = 0; i < NUM_BUCKETS * HIST_BINS; i++) h_bucket[i] += th[t].h_bucket[i];
+    for (i = 0; i < (int)num_cpus * HIST_BINS; i++) h_cpu[i] += th[t].h_cpu[i];
+    for (i = 0; i < opts.num_windows; i++) {
+      w_count[i] += th[t].w_count[i];
+      w_sum[i] += th[t].w_sum[i];
+      w_abs[i] += th[t].w_abs[i];
+    }
+  }
+
+  /* gather outliers in time order and cluster them */
+  for (t = 0; t < nt; t++) {
+    num_outliers += th[t].num_outliers;
+    outliers_lost += th[t].outliers_lost;
+  }
+  outliers = (outlier_t *)malloc((num_outliers + 1) * sizeof(outlier_t));
+  clusters = (cluster_t *)malloc((num_outliers + 1) * sizeof(cluster_t));
+  num_outliers = 0;
+  for (t = 0; t < nt; t++) {
+    memcpy(outliers + num_outliers, th[t].outliers, th[t].num_outliers * sizeof(outlier_t));
+    num_outliers += th[t].num_outliers;
+  }
+  qsort(outliers, num_outliers, sizeof(outlier_t), outlier_cmp);
+  for (per = 0; per < num_outliers; per++) {
+    outlier_t *o = &outliers[per];
+    cluster_t *c = num_clusters ? &clusters[num_clusters - 1] : NULL;
+    if (c == NULL || (o->tsc - c->end_tsc) * nsec_per_tsc > opts.cluster_nsec) {
+      c = &clusters[num_clusters++];
+      c->start_tsc = o->tsc;
+      c->count = 0;
+      c->sum_err = 0.0;
+      c->max_err = o->err;
+      c->first_cpu = o->cpu;
+      c->multi_cpu = 0;
+    }
+    c->end_tsc = o->tsc;
+    c->count++;
+    c->sum_err += o->err;
+    if (fabs(o->err) > fabs(c->max_err)) c->max_err = o->err;
+    if (o->cpu != c->first_cpu) c->multi_cpu = 1;
+  }
+  qsort(clusters, num_clusters, sizeof(cluster_t), cluster_cmp);
+
+  clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+  /* JSON; a cluster's "cpu" is -1 if its outliers came from more than one cpu */
+  if (opts.out_path != NULL) {
+    out = fopen(opts.out_path, "w");
+    if (out == NULL) {
+      fprintf(stderr, "%s:%d: ERROR -- could not open %s.\n", __FILE__, __LINE__, opts.out_path);
+      return -1;
+    }
+  }
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"log\": \"%s\",\n", opts.log_path);
+  fprintf(out, "  \"records\": %llu,\n", (unsigned long long)num_records);
+  fprintf(out, "  \"dropped\": %llu,\n", (unsigned long long)header->num_dropped);
+  fprintf(out, "  \"tsc_per_nsec\": %.6f,\n", header->tsc_per_nsec);
+  fprintf(out, "  \"analysis_threads\": %d,\n", nt);
+  fprintf(out, "  \"analysis_sec\": %.3f,\n", elapsed_sec(&t_start, &t_end));
+
+  fprintf(out, "  \"rings\": [");
+  for (i = 0; i < (int)header->num_rings; i++) {
+    fprintf(out, "%s\n    {\"thread\": %u, \"records\": %llu, \"dropped\": %llu}", i ? "," : "",
+        rings[i].thread, (unsigned long long)rings[i].records, (unsigned long long)rings[i].dropped);
+  }
+  fprintf(out, "\n  ],\n");
+
+  fprintf(out, "  \"summary\": {");
+  write_stats(out, &all, h_all);
+  fprintf(out, "},\n");
+
+  fprintf(out, "  \"kernels\": [");
+  for (i = 0, b = 0; i <= KERNEL_COUNT; i++) {
+    if (kernel[i].n == 0) continue;
+    fprintf(out, "%s\n    {\"kernel\": \"%s\", ", b++ ? "," : "", i < KERNEL_COUNT ? kernel_names[i] : "unknown");
+    write_stats(out, &kernel[i], h_kernel + i * HIST_BINS);
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ],\n");
+
+  fprintf(out, "  \"cpus\": [");
+  for (i = 0, b = 0; i < (int)num_cpus; i++) {
+    if (cpu[i].n == 0) continue;
+    fprintf(out, "%s\n    {\"cpu\": %d, ", b++ ? "," : "", i);
+    write_stats(out, &cpu[i], h_cpu + i * HIST_BINS);
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ],\n");
+
+  fprintf(out, "  \"duration_buckets\": [");
+  for (i = 0, b = 0; i < NUM_BUCKETS; i++) {
+    if (bucket[i].n == 0) continue;
+    fprintf(out, "%s\n    {\"min_nsec\": %llu, \"max_nsec\": %llu, ", b++ ? "," : "",
+        i ? 1ULL << i : 0ULL, (2ULL << i) - 1);
+    write_stats(out, &bucket[i], h_bucket + i * HIST_BINS);
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n  ],\n");
+
+  /* drift: least squares slope of window mean error against window time */
+  {
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, k = 0, x, y, slope = 0.0;
+    for (i = 0; i < opts.num_windows; i++) {
+      if (w_count[i] == 0) continue;
+      x = (i + 0.5) * window_tsc * nsec_per_tsc / 1e9;
+      y = w_sum[i] / w_count[i];
+      sx += x; sy += y; sxx += x * x; sxy += x * y; k++;
+    }
+    if (k > 1 && (k * sxx - sx * sx) > 0) slope = (k * sxy - sx * sy) / (k * sxx - sx * sx);
+    fprintf(out, "  \"drift\": {\"windows\": %d, \"window_nsec\": %.1f, \"slope_nsec_per_sec\": %.3f,\n",
+        opts.num_windows, window_tsc * nsec_per_tsc, slope);
+    fprintf(out, "    \"count\": [");
+    for (i = 0; i < opts.num_windows; i++) fprintf(out, "%s%llu", i ? ", " : "", (unsigned long long)w_count[i]);
+    fprintf(out, "],\n    \"mean_err_nsec\": [");
+    for (i = 0; i < opts.num_windows; i++) fprintf(out, "%s%.1f", i ? ", " : "", w_count[i] ? w_sum[i] / w_count[i] : 0.0);
+    fprintf(out, "],\n    \"mean_abs_err_nsec\": [");
+    for (i = 0; i < opts.num_windows; i++) fprintf(out, "%s%.1f", i ? ", " : "", w_count[i] ? w_abs[i] / w_count[i] : 0.0);
+    fprintf(out, "]},\n");
+  }
+
+  fprintf(out, "  \"outliers\": {\"sigma\": %.2f, \"count\": %llu, \"not_clustered\": %llu, \"clusters\": %llu, \"largest_clusters\": [",
+      opts.sigma, (unsigned long long)(num_outliers + outliers_lost), (unsigned long long)outliers_lost, (unsigned long long)num_clusters);
+  for (per = 0; per < num_clusters && per < MAX_CLUSTERS; per++) {
+    cluster_t *c = &clusters[per];
+    fprintf(out, "%s\n    {\"start_nsec\": %.0f, \"duration_nsec\": %.0f, \"count\": %llu, \"mean_err_nsec\": %.1f, \"max_err_nsec\": %.1f, \"cpu\": %d}",
+        per ? "," : "", (c->start_tsc - min_tsc) * nsec_per_tsc, (c->end_tsc - c->start_tsc) * nsec_per_tsc,
+        (unsigned long long)c->count, c->sum_err / c->count, c->max_err, c->multi_cpu ? -1 : (int)c->first_cpu);
+  }
+  fprintf(out, "\n  ]}\n");
+  fprintf(out, "}\n");
+
+  if (out != stdout) fclose(out);
+
+  for (t = 0; t < nt; t++) {
+    free(th[t].cpu);
+    free(th[t].h_all);
+    free(th[t].h_kernel);
+    free(th[t].h_bucket);
+    free(th[t].h_cpu);
+    free(th[t].w_count);
+    free(th[t].w_sum);
+    free(th[t].w_abs);
+    free(th[t].outliers);
+  }
+  free(th);
+  free(cpu);
+  free(outliers);
+  free(clusters);
+  munmap(map, st.st_size);
+  close(fd);
+  return 0;
+}
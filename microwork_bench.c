@@ -0,0 +1,354 @@
+/*****************************************************************************
+ *
+ * microwork_bench.c
+ *
+ * Microbenchmarks of the timing primitives the work loops depend on
+ * (CPUID, RDTSC, RDTSCP, LFENCE+RDTSC, clock_gettime) and of the work
+ * loops in microwork_inline_work.h. Each loop has two entries:
+ *   <loop>_entry : the shortest invocation (entry plus one iteration for
+ *                  the ASM loops, one multiplication for MXM, one cache
+ *                  line for MEM), i.e. mostly fixed setup cost
+ *   <loop>_iter  : the marginal cost of one iteration; each sample times
+ *                  the loop at N and about 2N iterations and divides the
+ *                  difference by the difference in iterations, so entry
+ *                  and exit costs cancel
+ *
+ * Each sample brackets UNROLL copies of the operation between
+ * TSC_START_C and TSC_END_C on a pinned cpu, after warm-up. The median
+ * cost of an empty bracket is subtracted and the result divided by
+ * UNROLL, giving a per-operation distribution in TSC ticks.
+ *
+ * Results are written as JSON, one primitive per line. Given a
+ * baseline file from an earlier run (-b), the program exits with 1 if
+ * any primitive's median is slower than the baseline's by more than
+ * the threshold, or if the baseline is unreadable or lacks a primitive.
+ *
+ *****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the ASM loops count their iterations into _steps (see SAMPLE_ITER) */
+#define WORK_ASM_STEP _steps++;
+
+#include "microwork_inline_work.h"
+#include "microwork_interfere.h"
+
+/* copies of a cheap primitive per sample */
+#define UNROLL 8
+
+/* most primitives reported */
+#define MAX_PRIMS 32
+
+/* per-iteration samples are kept in units of 1/ITER_SCALE tick */
+#define ITER_SCALE 1024
+
+/* runtime options */
+typedef struct bench_opts_s {
+  int num_samples;
+  int num_warmup;
+  int cpu;
+  char *out_path;         /* NULL for stdout */
+  char *baseline_path;    /* NULL for no comparison */
+  double threshold;       /* allowed fractional slowdown of the median */
+  double slack;           /* allowed absolute slowdown of the median, in ticks */
+} bench_opts_t;
+
+/* distribution of one primitive, in TSC ticks per operation */
+typedef struct prim_s {
+  const char *name;
+  int unroll;
+  double min, p50, p90, p99, max, mean;
+} prim_t;
+
+#define REPEAT8(_x) _x _x _x _x _x _x _x _x
+
+#define OP_CPUID        { uint32_t _ca = 0; __asm__ __volatile__ ("CPUID" : "+a" (_ca) : : "%rbx", "%rcx", "%rdx"); }
+#define OP_RDTSC        __asm__ __volatile__ ("RDTSC" : : : "%rax", "%rdx");
+#define OP_RDTSCP       __asm__ __volatile__ ("RDTSCP" : : : "%rax", "%rcx", "%rdx");
+#define OP_LFENCE_RDTSC __asm__ __volatile__ ("LFENCE; RDTSC" : : : "%rax", "%rdx");
+#define OP_CLOCK        clock_gettime(CLOCK_MONOTONIC, &_ts);
+
+/*
+ * Fill _samples[] with the TSC ticks taken by _op (which must already
+ * include any unrolling), after _warmup discarded samples.
+ */
+#define SAMPLE(_op, _samples, _n, _warmup)                 \
+  {                                                        \
+    int _s;                                                \
+    uint64_t _t0, _t1, _steps = 0;                         \
+    uint32_t _aux;                                         \
+    for (_s = 0; _s < (_warmup) + (_n); _s++) {            \
+      TSC_START_C(_t0)                                     \
+      _op                                                  \
+      TSC_END_C(_t1, _aux)                                 \
+      (void)_aux;                                          \
+      if (_s >= (_warmup)) (_samples)[_s - (_warmup)] = _t1 - _t0; \
+    }                                                      \
+    (void)_steps;                                          \
+  }
+
+/*
+ * Fill _samples[] with the marginal TSC ticks per iteration of the work
+ * loop _op, times ITER_SCALE: each sample runs _op with loop_num = _n1
+ * and then _n2, and divides the difference in ticks by the difference
+ * in _iters, the iterations run (loop_num, or _steps for the ASM loops,
+ * whose loop_num is a deadline in ticks).
+ */
+#define SAMPLE_ITER(_op, _n1, _n2, _iters, _samples, _n, _warmup) \
+  {                                                        \
+    int _s;                                                \
+    uint64_t _t0, _t1, _d1, _i1, _steps;                   \
+    uint32_t _aux;                                         \
+    for (_s = 0; _s < (_warmup) + (_n); _s++) {            \
+      loop_num = (_n1);                                    \
+      _steps = 0;                                          \
+      TSC_START_C(_t0)                                     \
+      _op                                                  \
+      TSC_END_C(_t1, _aux)                                 \
+      _d1 = _t1 - _t0;                                     \
+      _i1 = (_iters);                                      \
+      loop_num = (_n2);                                    \
+      _steps = 0;                                          \
+      TSC_START_C(_t0)                                     \
+      _op                                                  \
+      TSC_END_C(_t1, _aux)                                 \
+      (void)_aux;                                          \
+      if (_s >= (_warmup)) {                               \
+        (_samples)[_s - (_warmup)] = (_t1 - _t0 > _d1 && (_iters) > _i1) ? \
+            (_t1 - _t0 - _d1) * ITER_SCALE / ((_iters) - _i1) : 0; \
+      }                                                    \
+    }                                                      \
+    (void)_steps;                                          \
+  }
+
+/* per-operation distribution from raw sample ticks */
+static void summarize(prim_t *p, const char *name, int unroll, uint64_t *samples, int n, double overhead) {
+  double sum = 0.0;
+  int i;
+
+  qsort(samples, n, sizeof(*samples), mw_cmp_u64);
+  for (i = 0; i < n; i++) sum += samples[i];
+
+  #define PER_OP(_v) ((_v) > overhead ? ((_v) - overhead) / unroll : 0.0)
+  p->name = name;
+  p->unroll = unroll;
+  p->min = PER_OP((double)samples[0]);
+  p->p50 = PER_OP((double)samples[n / 2]);
+  p->p90 = PER_OP((double)samples[(n * 90) / 100]);
+  p->p99 = PER_OP((double)samples[(n * 99) / 100]);
+  p->max = PER_OP((double)samples[n - 1]);
+  p->mean = PER_OP(sum / n);
+  #undef PER_OP
+}
+
+/* per-iteration distribution from SAMPLE_ITER samples */
+static void summarize_iter(prim_t *p, const char *name, uint64_t *samples, int n) {
+  summarize(p, name, ITER_SCALE, samples, n, 0.0);
+  p->unroll = 1;
+}
+
+/*
+ * Look up a primitive's median in an open baseline file written by this
+ * program.
+ *
+ * Returns: 0 and sets *p50 if found, -1 otherwise.
+ */
+static int baseline_p50(FILE *fp, const char *name, double *p50) {
+  char line[1024], key[128];
+  char *s;
+
+  rewind(fp);
+  snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strstr(line, key) == NULL) continue;
+    s = strstr(line, "\"p50\": ");
+    if (s != NULL && sscanf(s, "\"p50\": %lf", p50) == 1) return 0;
+  }
+  return -1;
+}
+
+void usage(char **argv) {
+  printf("\n################################################################\n");
+  printf("Usage:\n");
+  printf("  %s [-n <samples>] [-w <warmup>] [-p <cpu>] [-o <json>] [-b <baseline json> [-x <fraction>] [-s <ticks>]]\n", argv[0]);
+  printf("\nWhere:\n");
+  printf("  -n <samples>  : samples per primitive (optional; default 10000)\n");
+  printf("  -w <warmup>   : discarded warm-up samples per primitive (optional; default 1000)\n");
+  printf("  -p <cpu>      : cpu to pin to (optional; default 0)\n");
+  printf("  -o <json>     : output file (optional; default stdout)\n");
+  printf("  -b <json>     : baseline from an earlier run; exit 1 if any median regresses or is missing (optional)\n");
+  printf("  -x <fraction> : allowed fractional slowdown of a median (optional; default 0.10)\n");
+  printf("  -s <ticks>    : allowed absolute slowdown of a median (optional; default 2)\n");
+  printf("################################################################");
+  printf("\n");
+  exit(-1);
+}
+
+int process_args(int argc, char **argv, bench_opts_t *opts) {
+  int c;
+  extern char *optarg;
+
+  opts->num_samples = 10000;
+  opts->num_warmup = 1000;
+  opts->cpu = 0;
+  opts->out_path = NULL;
+  opts->baseline_path = NULL;
+  opts->threshold = 0.10;
+  opts->slack = 2.0;
+
+  while ((c = getopt(argc, argv, "b:n:o:p:s:w:x:")) != -1) {
+    switch (c) {
+      case 'b': opts->baseline_path = optarg; break;
+      case 'n': opts->num_samples = atoi(optarg); break;
+      case 'o': opts->out_path = optarg; break;
+      case 'p': opts->cpu = atoi(optarg); break;
+      case 's': opts->slack = atof(optarg); break;
+      case 'w': opts->num_warmup = atoi(optarg); break;
+      case 'x': opts->threshold = atof(optarg); break;
+      default: usage(argv);
+    }
+  }
+  if (opts->num_samples < 1) usage(argv);
+  return 0;
+}
+
+/*
+ * Mr. Main
+ */
+int main(int argc, char **argv) {
+  bench_opts_t opts;
+  prim_t prims[MAX_PRIMS];
+  uint64_t *samples, loop_num;
+  uint64_t work_buf_lines = 1024, *work_buf;
+  struct timespec _ts;
+  double overhead, tsc_per_nsec, base;
+  char host[256] = "unknown";
+  FILE *out = stdout, *baseline;
+  int n, np = 0, i, regressed = 0, missing = 0;
+
+  process_args(argc, argv, &opts);
+  n = opts.num_samples;
+  samples = (uint64_t *)malloc(n * sizeof(*samples));
+
+  if (mw_pin_self(opts.cpu) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: could not pin to cpu %d\n", __FILE__, __LINE__, opts.cpu);
+  }
+  gethostname(host, sizeof(host));
+  tsc_per_nsec = mw_measure_tsc_rate();
+
+  /* the empty bracket; its median is subtracted from everything else */
+  SAMPLE(, samples, n, opts.num_warmup)
+  summarize(&prims[np++], "timer", 1, samples, n, 0.0);
+  overhead = prims[0].p50;
+
+  SAMPLE(REPEAT8(OP_CPUID), samples, n, opts.num_warmup)
+  summarize(&prims[np++], "cpuid", UNROLL, samples, n, overhead);
+  SAMPLE(REPEAT8(OP_RDTSC), samples, n, opts.num_warmup)
+  summarize(&prims[np++], "rdtsc", UNROLL, samples, n, overhead);
+  SAMPLE(REPEAT8(OP_RDTSCP), samples, n, opts.num_warmup)
+  summarize(&prims[np++], "rdtscp", UNROLL, samples, n, overhead);
+  SAMPLE(REPEAT8(OP_LFENCE_RDTSC), samples, n, opts.num_warmup)
+  summarize(&prims[np++], "lfence_rdtsc", UNROLL, samples, n, overhead);
+  SAMPLE(REPEAT8(OP_CLOCK), samples, n, opts.num_warmup)
+  summarize(&prims[np++], "clock_gettime", UNROLL, samples, n, overhead);
+
+  /* each work loop: its shortest invocation, then the marginal cost of 
+     an iteration between N and about 2N iterations */
+  loop_num = 0;
+  SAMPLE({ WORK_ASM_NOP_C }, samples, n, opts.num_warmup)
+  summarize(&prims[np++], "work_asm_nop_entry", 1, samples, n, overhead);
+  SAMPLE({ WORK_ASM_MUL_C }, samples, n, opts.num_warmup)
+  summarize(&prims[np++], "work_asm_mul_entry", 1, samples, n, overhead);
+  SAMPLE({ WORK_ASM_FADD_C }, samples, n, opts.num_warmup)
+  summarize(&prims[np++], "work_asm_fadd_entry", 1, samples, n, overhead);
+  SAMPLE({ WORK_ASM_FMUL_C }, samples, n, opts.num_warmup)
+  summarize(&prims[np++], "work_asm_fmul_entry", 1, samples, n, overhead);
+  /* deadlines of ~ASM_ITERS and ~2 * ASM_ITERS iterations, from the entry cost */
+  #define ASM_ITERS 8
+  #define ASM_DEADLINE(_entry) ((uint64_t)((_entry).p50 > 1.0 ? (_entry).p50 : 1.0) * ASM_ITERS)
+  SAMPLE_ITER({ WORK_ASM_NOP_C }, ASM_DEADLINE(prims[np - 4]), 2 * ASM_DEADLINE(prims[np - 4]), _steps, samples, n, opts.num_warmup / 10)
+  summarize_iter(&prims[np++], "work_asm_nop_iter", samples, n);
+  SAMPLE_ITER({ WORK_ASM_MUL_C }, ASM_DEADLINE(prims[np - 4]), 2 * ASM_DEADLINE(prims[np - 4]), _steps, samples, n, opts.num_warmup / 10)
+  summarize_iter(&prims[np++], "work_asm_mul_iter", samples, n);
+  SAMPLE_ITER({ WORK_ASM_FADD_C }, ASM_DEADLINE(prims[np - 4]), 2 * ASM_DEADLINE(prims[np - 4]), _steps, samples, n, opts.num_warmup / 10)
+  summarize_iter(&prims[np++], "work_asm_fadd_iter", samples, n);
+  SAMPLE_ITER({ WORK_ASM_FMUL_C }, ASM_DEADLINE(prims[np - 4]), 2 * ASM_DEADLINE(prims[np - 4]), _steps, samples, n, opts.num_warmup / 10)
+  summarize_iter(&prims[np++], "work_asm_fmul_iter", samples, n);
+  #undef ASM_DEADLINE
+  #undef ASM_ITERS
+
+  loop_num = 1;
+  SAMPLE({ WORK_MXM_C }, samples, n, opts.num_warmup / 100 + 1)
+  summarize(&prims[np++], "work_mxm_entry", 1, samples, n, overhead);
+  SAMPLE_ITER({ WORK_MXM_C }, 1, 2, loop_num, samples, n, opts.num_warmup / 100 + 1)
+  summarize_iter(&prims[np++], "work_mxm_iter", samples, n);
+
+  work_buf = (uint64_t *)calloc(work_buf_lines * _WORK_LINE_WORDS, sizeof(uint64_t));
+  loop_num = 1;
+  SAMPLE({ WORK_MEM_C }, samples, n, opts.num_warmup)
+  summarize(&prims[np++], "work_mem_entry", 1, samples, n, overhead);
+  SAMPLE_ITER({ WORK_MEM_C }, work_buf_lines, 2 * work_buf_lines, loop_num, samples, n, opts.num_warmup / 10)
+  summarize_iter(&prims[np++], "work_mem_iter", samples, n);
+  free(work_buf);
+
+  if (opts.out_path != NULL) {
+    out = fopen(opts.out_path, "w");
+    if (out == NULL) {
+      fprintf(stderr, "%s:%d: ERROR -- could not open %s.\n", __FILE__, __LINE__, opts.out_path);
+      return -1;
+    }
+  }
+  fprintf(out, "{\n");
+  fprintf(out, "  \"host\": \"%s\",\n", host);
+  fprintf(out, "  \"cpu\": %d,\n", opts.cpu);
+  fprintf(out, "  \"samples\": %d,\n", n);
+  fprintf(out, "  \"warmup\": %d,\n", opts.num_warmup);
+  fprintf(out, "  \"tsc_per_nsec\": %.6f,\n", tsc_per_nsec);
+  fprintf(out, "  \"units\": \"tsc ticks per operation\",\n");
+  fprintf(out, "  \"primitives\": [\n");
+  for (i = 0; i < np; i++) {
+    fprintf(out, "    {\"name\": \"%s\", \"unroll\": %d, \"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f, \"mean\": %.2f, \"p50_nsec\": %.2f}%s\n",
+        prims[i].name, prims[i].unroll, prims[i].min, prims[i].p50, prims[i].p90, prims[i].p99, prims[i].max, prims[i].mean,
+        prims[i].p50 / tsc_per_nsec, i < np - 1 ? "," : "");
+  }
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+  if (out != stdout) fclose(out);
+
+  /* regression check against the baseline medians */
+  if (opts.baseline_path != NULL) {
+    baseline = fopen(opts.baseline_path, "r");
+    if (baseline == NULL) {
+      fprintf(stderr, "%s:%d: ERROR -- could not open baseline %s.\n", __FILE__, __LINE__, opts.baseline_path);
+      free(samples);
+      return 1;
+    }
+    for (i = 0; i < np; i++) {
+      if (baseline_p50(baseline, prims[i].name, &base) != 0) {
+        fprintf(stderr, "%s:%d: ERROR -- %s not in baseline %s.\n", __FILE__, __LINE__, prims[i].name, opts.baseline_path);
+        missing++;
+        continue;
+      }
+      if (prims[i].p50 > base * (1.0 + opts.threshold) && prims[i].p50 - base > opts.slack) {
+        fprintf(stderr, "REGRESSION %s: median %.2f ticks vs baseline %.2f (+%.1f%%)\n",
+            prims[i].name, prims[i].p50, base, 100.0 * (prims[i].p50 - base) / (base > 0 ? base : 1.0));
+        regressed = 1;
+      }
+    }
+    fclose(baseline);
+    if (missing) {
+      fprintf(stderr, "%d primitive(s) missing from %s; re-record it with make bench-baseline\n", missing, opts.baseline_path);
+      regressed = 1;
+    } else if (!regressed) {
+      fprintf(stderr, "No regressions against %s\n", opts.baseline_path);
+    }
+  }
+
+  free(samples);
+  return regressed;
+}
@@ -0,0 +1,35 @@
+/*****************************************************************************
+ *
+ * microwork_common.c
+ *
+ * State and helpers shared by the drivers, independent of work type: 
+ * the settings and per-thread statistics for preemption gap detection 
+ * in the ASM work loops (WORK_GAP_DETECT), and the TSC rate and sort 
+ * helpers. See microwork_inline_work.h.
+ *
+ *****************************************************************************/
+
+#include <time.h>
+
+#include "microwork_inline_work.h"
+
+uint64_t gap_threshold = GAP_THRESHOLD_DEFAULT;
+gap_policy_t gap_policy = GAP_WALL;
+__thread gap_stats_t gap_stats;
+
+int mw_cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+double mw_measure_tsc_rate() {
+  struct timespec a, b, pause = { 0, 50000000 };
+  uint64_t ta, tb;
+
+  clock_gettime(CLOCK_MONOTONIC, &a);
+  TSC_START_C(ta)
+  nanosleep(&pause, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &b);
+  TSC_START_C(tb)
+  return (tb - ta) / (double)((b.tv_sec - a.tv_sec) * 1000000000LL + (b.tv_nsec - a.tv_nsec));
+}
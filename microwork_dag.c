@@ -0,0 +1,612 @@
+/*****************************************************************************
+ *
+ * microwork_dag.c
+ *
+ * Task-DAG workload simulator on a work-stealing thread pool.
+ * See microwork_dag.h.
+ *
+ *****************************************************************************/
+
+#include <errno.h>
+#include <sched.h>
+
+#include "microwork_dag.h"
+#include "microwork_interfere.h"
+
+/* deque results besides a task index */
+#define DEQUE_EMPTY (-1)
+#define DEQUE_ABORT (-2)
+
+/* longest line in a graph file */
+#define DAG_LINE_MAX 1024
+
+/* start gate values */
+#define GATE_WAIT  0
+#define GATE_GO    1
+#define GATE_ABORT (-1)
+
+/*
+ * Chase-Lev work-stealing deque, after Le, Pop, Cohen and Zappa Nardelli,
+ * "Correct and efficient work-stealing for weak memory models" (PPoPP 2013).
+ * Each task is pushed exactly once per run, so a buffer of num_tasks
+ * entries never wraps onto live entries and the deque does not grow.
+ */
+typedef struct dag_deque_s {
+  int64_t top __attribute__((aligned(64)));       /* stolen from */
+  int64_t bottom __attribute__((aligned(64)));    /* owner pushes and takes */
+  int64_t mask;
+  int *buf;
+} dag_deque_t;
+
+/* one worker */
+typedef struct dag_worker_s {
+  dag_deque_t deque;
+  pthread_t thread;
+  int id;
+  uint64_t rng;
+  mw_dag_worker_stats_t stats;
+  struct dag_pool_s *pool;
+} dag_worker_t;
+
+/* state shared by the workers of a run */
+typedef struct dag_pool_s {
+  mw_dag_t *dag;
+  const mw_hybrid_t *hybrid;
+  int num_workers;
+  dag_worker_t *workers;
+  int ready;                                      /* workers waiting at the gate */
+  int gate;                                       /* GATE_* */
+  int done __attribute__((aligned(64)));          /* tasks complete */
+  uint64_t start_nsec;
+  uint64_t end_nsec;                              /* when the last task completed */
+} dag_pool_t;
+
+static uint64_t clock_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* xorshift64* */
+static inline uint64_t next_rand(uint64_t *state) {
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* uniform in [0, 1) */
+static inline double next_unit(uint64_t *state) {
+  return (next_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*****************************************************************************
+ * DEQUE
+ *****************************************************************************/
+
+static int deque_init(dag_deque_t *q, int capacity) {
+  int64_t size = 1;
+  while (size < capacity) size <<= 1;
+  q->top = 0;
+  q->bottom = 0;
+  q->mask = size - 1;
+  q->buf = (int *)malloc(size * sizeof(*q->buf));
+  return q->buf == NULL ? -1 : 0;
+}
+
+/* owner only */
+static inline void deque_push(dag_deque_t *q, int task) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->buf[b & q->mask], task, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+/* owner only: newest task, or DEQUE_EMPTY */
+static inline int deque_take(dag_deque_t *q) {
+  int64_t b = __atomic_load_n(&q->bottom, __ATOMIC_RELAXED) - 1;
+  int64_t t;
+  int task;
+
+  __atomic_store_n(&q->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&q->top, __ATOMIC_RELAXED);
+  if (t > b) {
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+    return DEQUE_EMPTY;
+  }
+  task = __atomic_load_n(&q->buf[b & q->mask], __ATOMIC_RELAXED);
+  if (t == b) {
+    /* last task: race the thieves for it */
+    if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) task = DEQUE_EMPTY;
+    __atomic_store_n(&q->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return task;
+}
+
+/* any thread: oldest task, DEQUE_EMPTY, or DEQUE_ABORT if another thread won it */
+static inline int deque_steal(dag_deque_t *q) {
+  int64_t t = __atomic_load_n(&q->top, __ATOMIC_ACQUIRE);
+  int64_t b;
+  int task;
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&q->bottom, __ATOMIC_ACQUIRE);
+  if (t >= b) return DEQUE_EMPTY;
+  task = __atomic_load_n(&q->buf[t & q->mask], __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&q->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) return DEQUE_ABORT;
+  return task;
+}
+
+/*****************************************************************************
+ * GRAPH
+ *****************************************************************************/
+
+/* allocate a graph of num_tasks tasks and num_edges edges */
+static int dag_alloc(mw_dag_t *dag, int num_tasks, int num_edges) {
+  memset(dag, 0, sizeof(*dag));
+  dag->num_tasks = num_tasks;
+  dag->num_edges = num_edges;
+  dag->tasks = (dag_task_t *)calloc(num_tasks, sizeof(*dag->tasks));
+  dag->succ = (int *)calloc(num_edges > 0 ? num_edges : 1, sizeof(*dag->succ));
+  dag->order = (int *)calloc(num_tasks, sizeof(*dag->order));
+  if (dag->tasks == NULL || dag->succ == NULL || dag->order == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating a graph of %d tasks.\n", __FILE__, __LINE__, num_tasks);
+    mw_dag_free(dag);
+    return -1;
+  }
+  return 0;
+}
+
+/* Build successor lists from edge arrays and a topological order.
+ *
+ * Returns: 0 on success, -1 if the graph has a cycle.
+ */
+static int dag_link(mw_dag_t *dag, const int *from, const int *to) {
+  int *fill, *indeg;
+  int e, i, head = 0, tail = 0, v, s;
+
+  for (i = 0; i < dag->num_tasks; i++) {
+    dag->tasks[i].num_pred = 0;
+    dag->tasks[i].num_succ = 0;
+  }
+  for (e = 0; e < dag->num_edges; e++) {
+    dag->tasks[from[e]].num_succ++;
+    dag->tasks[to[e]].num_pred++;
+  }
+  for (i = 0, s = 0; i < dag->num_tasks; i++) {
+    dag->tasks[i].succ_off = s;
+    s += dag->tasks[i].num_succ;
+  }
+
+  fill = (int *)calloc(dag->num_tasks, sizeof(*fill));
+  indeg = (int *)calloc(dag->num_tasks, sizeof(*indeg));
+  if (fill == NULL || indeg == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating graph index.\n", __FILE__, __LINE__);
+    free(fill);
+    free(indeg);
+    return -1;
+  }
+  for (e = 0; e < dag->num_edges; e++) {
+    dag->succ[dag->tasks[from[e]].succ_off + fill[from[e]]++] = to[e];
+  }
+
+  /* Kahn's algorithm */
+  for (i = 0; i < dag->num_tasks; i++) {
+    indeg[i] = dag->tasks[i].num_pred;
+    if (indeg[i] == 0) dag->order[tail++] = i;
+  }
+  while (head < tail) {
+    v = dag->order[head++];
+    for (s = 0; s < dag->tasks[v].num_succ; s++) {
+      if (--indeg[dag->succ[dag->tasks[v].succ_off + s]] == 0) dag->order[tail++] = dag->succ[dag->tasks[v].succ_off + s];
+    }
+  }
+  free(fill);
+  free(indeg);
+
+  if (tail != dag->num_tasks) {
+    fprintf(stderr, "%s:%d: ERROR -- task graph has a cycle.\n", __FILE__, __LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+/* index of name in names[], or -1 */
+static int lookup(const char *name, const char **names, int count) {
+  int i;
+  for (i = 0; i < count; i++) {
+    if (strcmp(name, names[i]) == 0) return i;
+  }
+  return -1;
+}
+
+int mw_dag_load(const char *path, mw_dag_t *dag) {
+  static const char *kernel_names[] = DAG_KERNEL_NAMES;
+  static const char *dist_names[] = DAG_DIST_NAMES;
+  char line[DAG_LINE_MAX], kernel[64], dist[64];
+  int num_tasks = 0, num_edges = 0, lineno = 0, e = 0, id, a, b, n, k, d, rc = -1;
+  int *from = NULL, *to = NULL, *seen = NULL;
+  double p1, p2;
+  FILE *fp;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- could not open task graph %s (errno %d).\n", __FILE__, __LINE__, path, errno);
+    return -1;
+  }
+
+  /* first pass: count */
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strncmp(line, "task", 4) == 0) num_tasks++;
+    else if (strncmp(line, "edge", 4) == 0) num_edges++;
+  }
+  if (num_tasks == 0) {
+    fprintf(stderr, "%s:%d: ERROR -- no tasks in %s.\n", __FILE__, __LINE__, path);
+    fclose(fp);
+    return -1;
+  }
+  if (dag_alloc(dag, num_tasks, num_edges) != 0) {
+    fclose(fp);
+    return -1;
+  }
+  from = (int *)calloc(num_edges + 1, sizeof(*from));
+  to = (int *)calloc(num_edges + 1, sizeof(*to));
+  seen = (int *)calloc(num_tasks, sizeof(*seen));
+  if (from == NULL || to == NULL || seen == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating edges.\n", __FILE__, __LINE__);
+    goto out;
+  }
+
+  /* second pass: parse */
+  rewind(fp);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    line[strcspn(line, "#\n")] = '\0';
+    if (strncmp(line, "task", 4) == 0) {
+      p2 = 0.0;
+      n = sscanf(line, "task %d %63s %63s %lf %lf", &id, kernel, dist, &p1, &p2);
+      k = n >= 2 ? lookup(kernel, kernel_names, DAG_KERNEL_COUNT) : -1;
+      d = n >= 3 ? lookup(dist, dist_names, DIST_COUNT) : -1;
+      if (n < 4 || id < 0 || id >= num_tasks || k < 0 || d < 0 ||
+          ((d == DIST_UNIFORM || d == DIST_NORMAL) && n < 5)) {
+        fprintf(stderr, "%s:%d: ERROR -- %s:%d: bad task declaration.\n", __FILE__, __LINE__, path, lineno);
+        goto out;
+      }
+      if (seen[id]++) {
+        fprintf(stderr, "%s:%d: ERROR -- %s:%d: task %d declared twice.\n", __FILE__, __LINE__, path, lineno, id);
+        goto out;
+      }
+      dag->tasks[id].kernel = (dag_kernel_t)k;
+      dag->tasks[id].dist = (dag_dist_t)d;
+      dag->tasks[id].p1 = p1;
+      dag->tasks[id].p2 = p2;
+    } else if (strncmp(line, "edge", 4) == 0) {
+      if (sscanf(line, "edge %d %d", &a, &b) != 2 || a < 0 || a >= num_tasks || b < 0 || b >= num_tasks || a == b) {
+        fprintf(stderr, "%s:%d: ERROR -- %s:%d: bad edge.\n", __FILE__, __LINE__, path, lineno);
+        goto out;
+      }
+      from[e] = a;
+      to[e] = b;
+      e++;
+    } else if (strspn(line, " \t\r") != strlen(line)) {
+      fprintf(stderr, "%s:%d: ERROR -- %s:%d: expected task or edge.\n", __FILE__, __LINE__, path, lineno);
+      goto out;
+    }
+  }
+  for (id = 0; id < num_tasks; id++) {
+    if (!seen[id]) {
+      fprintf(stderr, "%s:%d: ERROR -- %s: task ids must be 0..%d; %d is missing.\n", __FILE__, __LINE__, path, num_tasks - 1, id);
+      goto out;
+    }
+  }
+  rc = dag_link(dag, from, to);
+
+out:
+  fclose(fp);
+  free(from);
+  free(to);
+  free(seen);
+  if (rc != 0) mw_dag_free(dag);
+  return rc;
+}
+
+int mw_dag_layered(int num_layers, int width, int fan_in, dag_kernel_t kernel, uint64_t mean_nsec,
+                   uint64_t seed, mw_dag_t *dag) {
+  uint64_t rng = seed ? seed : 1;
+  int num_tasks = num_layers * width, num_edges, l, w, f, e = 0, id, rc;
+  int *from, *to;
+
+  if (num_layers < 1 || width < 1) {
+    fprintf(stderr, "%s:%d: ERROR -- layered graph needs at least one layer and task per layer.\n", __FILE__, __LINE__);
+    return -1;
+  }
+  if (fan_in > width) fan_in = width;
+  if (fan_in < 0) fan_in = 0;
+  num_edges = (num_layers - 1) * width * fan_in;
+  if (dag_alloc(dag, num_tasks, num_edges) != 0) return -1;
+
+  from = (int *)calloc(num_edges + 1, sizeof(*from));
+  to = (int *)calloc(num_edges + 1, sizeof(*to));
+  if (from == NULL || to == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating edges.\n", __FILE__, __LINE__);
+    free(from);
+    free(to);
+    mw_dag_free(dag);
+    return -1;
+  }
+
+  for (l = 0; l < num_layers; l++) {
+    for (w = 0; w < width; w++) {
+      id = l * width + w;
+      dag->tasks[id].kernel = kernel;
+      dag->tasks[id].dist = DIST_EXP;
+      dag->tasks[id].p1 = (double)mean_nsec;
+      if (l == 0) continue;
+      /* fan_in distinct predecessors: consecutive from a random start */
+      int first = (int)(next_rand(&rng) % width);
+      for (f = 0; f < fan_in; f++) {
+        from[e] = (l - 1) * width + (first + f) % width;
+        to[e] = id;
+        e++;
+      }
+    }
+  }
+
+  rc = dag_link(dag, from, to);
+  free(from);
+  free(to);
+  if (rc != 0) mw_dag_free(dag);
+  return rc;
+}
+
+void mw_dag_sample(mw_dag_t *dag, uint64_t seed, c_results_t *c_results, const mw_hybrid_t *hybrid) {
+  uint64_t rng = seed ? seed : 1, *finish, longest;
+  double x, u1, u2;
+  int i, s, v;
+  dag_task_t *task;
+
+  dag->total_work_nsec = 0;
+  for (i = 0; i < dag->num_tasks; i++) {
+    task = &dag->tasks[i];
+    switch (task->dist) {
+      case DIST_UNIFORM:
+        x = task->p1 + (task->p2 - task->p1) * next_unit(&rng);
+        break;
+      case DIST_NORMAL:
+        /* Box-Muller */
+        u1 = next_unit(&rng);
+        u2 = next_unit(&rng);
+        x = task->p1 + task->p2 * sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+        break;
+      case DIST_EXP:
+        x = -task->p1 * log(1.0 - next_unit(&rng));
+        break;
+      case DIST_FIXED:
+      default:
+        x = task->p1;
+        break;
+    }
+    task->nsec = x > 0.0 ? (uint64_t)x : 0;
+    dag->total_work_nsec += task->nsec;
+
+    switch (task->kernel) {
+      case DAG_WORK:
+        task->loop_num = calc_loop_num(task->nsec, c_results);
+        break;
+      case DAG_WAIT:
+        task->loop_num = 0;
+        break;
+      default:
+        task->loop_num = (uint64_t)(task->nsec * hybrid->tsc_per_nsec);
+        break;
+    }
+  }
+
+  /* longest path, in topological order */
+  finish = (uint64_t *)calloc(dag->num_tasks, sizeof(*finish));
+  if (finish == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating critical path.\n", __FILE__, __LINE__);
+    dag->critical_path_nsec = 0;
+    return;
+  }
+  longest = 0;
+  for (i = 0; i < dag->num_tasks; i++) {
+    v = dag->order[i];
+    finish[v] += dag->tasks[v].nsec;
+    if (finish[v] > longest) longest = finish[v];
+    for (s = 0; s < dag->tasks[v].num_succ; s++) {
+      int w = dag->succ[dag->tasks[v].succ_off + s];
+      if (finish[v] > finish[w]) finish[w] = finish[v];
+    }
+  }
+  dag->critical_path_nsec = longest;
+  free(finish);
+}
+
+void mw_dag_free(mw_dag_t *dag) {
+  free(dag->tasks);
+  free(dag->succ);
+  free(dag->order);
+  dag->tasks = NULL;
+  dag->succ = NULL;
+  dag->order = NULL;
+}
+
+/*****************************************************************************
+ * RUN
+ *****************************************************************************/
+
+/* run one task body */
+static void execute(const dag_pool_t *pool, const dag_task_t *task) {
+  uint64_t loop_num = task->loop_num;
+
+  switch (task->kernel) {
+    case DAG_WORK:
+      timed_work(loop_num);
+      break;
+    case DAG_WAIT:
+      mw_hybrid_wait(pool->hybrid, task->nsec, NULL);
+      break;
+    case DAG_ASM_NOP:
+      { WORK_ASM_NOP_C }
+      break;
+    case DAG_ASM_MUL:
+      { WORK_ASM_MUL_C }
+      break;
+    case DAG_ASM_FADD:
+      { WORK_ASM_FADD_C }
+      break;
+    case DAG_ASM_FMUL:
+      { WORK_ASM_FMUL_C }
+      break;
+    default:
+      break;
+  }
+}
+
+/* a task from a random victim, or DEQUE_EMPTY if a full sweep found none */
+static int steal(dag_worker_t *self) {
+  dag_pool_t *pool = self->pool;
+  int i, v, task, first = (int)(next_rand(&self->rng) % pool->num_workers);
+
+  for (i = 0; i < pool->num_workers; i++) {
+    v = (first + i) % pool->num_workers;
+    if (v == self->id) continue;
+    task = deque_steal(&pool->workers[v].deque);
+    if (task >= 0) {
+      self->stats.steals++;
+      return task;
+    }
+    self->stats.failed_steals++;
+  }
+  return DEQUE_EMPTY;
+}
+
+static void *worker_main(void *arg) {
+  dag_worker_t *self = (dag_worker_t *)arg;
+  dag_pool_t *pool = self->pool;
+  mw_dag_t *dag = pool->dag;
+  dag_task_t *task;
+  uint64_t begin, t0, t1;
+  int t, s, w, k, pauses = 1, gate;
+
+  if (self->stats.cpu >= 0 && mw_pin_self(self->stats.cpu) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: could not pin worker %d to cpu %d\n", __FILE__, __LINE__, self->id, self->stats.cpu);
+  }
+  __atomic_add_fetch(&pool->ready, 1, __ATOMIC_ACQ_REL);
+  while ((gate = __atomic_load_n(&pool->gate, __ATOMIC_ACQUIRE)) == GATE_WAIT) sched_yield();
+  if (gate == GATE_ABORT) return NULL;
+  begin = clock_nsec();
+
+  while (__atomic_load_n(&pool->done, __ATOMIC_ACQUIRE) < dag->num_tasks) {
+    t = deque_take(&self->deque);
+    if (t < 0) t = steal(self);
+    if (t < 0) {
+      /* back off: twice the PAUSEs after each miss, then yield */
+      if (pauses <= MW_DAG_IDLE_PAUSE_MAX) {
+        for (k = 0; k < pauses; k++) __asm__ __volatile__ ("PAUSE");
+        pauses *= 2;
+      } else {
+        sched_yield();
+      }
+      continue;
+    }
+    pauses = 1;
+
+    task = &dag->tasks[t];
+    t0 = clock_nsec();
+    execute(pool, task);
+    t1 = clock_nsec();
+    self->stats.tasks++;
+    self->stats.busy_nsec += t1 - t0;
+    self->stats.requested_nsec += task->nsec;
+
+    /* release successors onto our own deque */
+    for (s = 0; s < task->num_succ; s++) {
+      w = dag->succ[task->succ_off + s];
+      if (__atomic_sub_fetch(&dag->tasks[w].pending, 1, __ATOMIC_ACQ_REL) == 0) deque_push(&self->deque, w);
+    }
+    if (__atomic_add_fetch(&pool->done, 1, __ATOMIC_ACQ_REL) == dag->num_tasks) {
+      pool->end_nsec = clock_nsec();
+    }
+  }
+
+  self->stats.idle_nsec = clock_nsec() - begin - self->stats.busy_nsec;
+  return NULL;
+}
+
+int mw_dag_run(mw_dag_t *dag, int num_workers, const int *cpus, const mw_hybrid_t *hybrid,
+               uint64_t seed, mw_dag_report_t *report) {
+  dag_pool_t pool;
+  dag_worker_t *workers;
+  int i, r = 0, rc = 0;
+
+  if (num_workers < 1 || num_workers > MW_DAG_MAX_WORKERS) {
+    fprintf(stderr, "%s:%d: ERROR -- number of workers must be 1..%d.\n", __FILE__, __LINE__, MW_DAG_MAX_WORKERS);
+    return -1;
+  }
+
+  /* aligned, so the deque ends sit on their own cache lines */
+  if (posix_memalign((void **)&workers, 64, num_workers * sizeof(*workers)) != 0) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating workers.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  memset(workers, 0, num_workers * sizeof(*workers));
+  memset(&pool, 0, sizeof(pool));
+  pool.dag = dag;
+  pool.hybrid = hybrid;
+  pool.num_workers = num_workers;
+  pool.workers = workers;
+  pool.done = 0;
+
+  for (i = 0; i < num_workers; i++) {
+    workers[i].id = i;
+    workers[i].pool = &pool;
+    workers[i].rng = (seed ? seed : 1) * 0x9E3779B97F4A7C15ULL + i + 1;
+    workers[i].stats.cpu = (cpus != NULL && cpus[i] >= 0) ? cpus[i] : -1;
+    if (deque_init(&workers[i].deque, dag->num_tasks) != 0) {
+      fprintf(stderr, "%s:%d: ERROR -- failure allocating deque.\n", __FILE__, __LINE__);
+      rc = -1;
+      goto out;
+    }
+  }
+
+  /* deal the roots round robin before anyone runs */
+  for (i = 0; i < dag->num_tasks; i++) {
+    dag->tasks[i].pending = dag->tasks[i].num_pred;
+    if (dag->tasks[i].num_pred == 0) deque_push(&workers[r++ % num_workers].deque, i);
+  }
+
+  /* workers wait at the gate until all of them are pinned and ready */
+  pool.ready = 0;
+  pool.gate = GATE_WAIT;
+  for (i = 0; i < num_workers; i++) {
+    if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+      fprintf(stderr, "%s:%d: ERROR -- failure creating worker %d.\n", __FILE__, __LINE__, i);
+      __atomic_store_n(&pool.gate, GATE_ABORT, __ATOMIC_RELEASE);
+      while (--i >= 0) pthread_join(workers[i].thread, NULL);
+      rc = -1;
+      goto out;
+    }
+  }
+  while (__atomic_load_n(&pool.ready, __ATOMIC_ACQUIRE) < num_workers) sched_yield();
+
+  pool.start_nsec = clock_nsec();
+  __atomic_store_n(&pool.gate, GATE_GO, __ATOMIC_RELEASE);
+  for (i = 0; i < num_workers; i++) pthread_join(workers[i].thread, NULL);
+
+  report->num_workers = num_workers;
+  report->makespan_nsec = pool.end_nsec - pool.start_nsec;
+  report->critical_path_nsec = dag->critical_path_nsec;
+  report->total_work_nsec = dag->total_work_nsec;
+  for (i = 0; i < num_workers; i++) report->workers[i] = workers[i].stats;
+
+out:
+  for (i = 0; i < num_workers; i++) free(workers[i].deque.buf);
+  free(workers);
+  return rc;
+}
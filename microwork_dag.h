@@ -0,0 +1,152 @@
+/*****************************************************************************
+ *
+ * microwork_dag.h
+ *
+ * Task-DAG workload simulator on a work-stealing thread pool.
+ *
+ * A task graph is read from a text file, one declaration per line
+ * ('#' starts a comment):
+ *
+ *   task <id> <kernel> <dist> <p1> [<p2>]
+ *   edge <from> <to>
+ *
+ * Task ids are 0 .. num_tasks-1, each declared once; an edge makes <to>
+ * wait for <from>. The kernel is one of:
+ *
+ *   work      the calibrated work loop the program was built with
+ *   wait      a hybrid sleep-then-spin wait (microwork_hybrid.h), e.g.,
+ *             for simulated I/O
+ *   asm_nop, asm_mul, asm_fadd, asm_fmul
+ *             that ASM loop, inline; these run for a number of TSC
+ *             cycles, so the measured TSC rate converts nsecs to cycles
+ *
+ * and the duration, in nsecs, is drawn from one of:
+ *
+ *   fixed <nsec> | uniform <lo> <hi> | normal <mean> <sd> | exp <mean>
+ *
+ * Durations are sampled once per run from a seed, before the run, so
+ * the critical path (longest chain of sampled durations) and the total
+ * work are exact lower bounds for that run's makespan.
+ *
+ * Each worker owns a Chase-Lev deque: it pushes released successors
+ * and takes from the bottom, and when empty steals from the top of a
+ * randomly chosen victim. Tasks with no predecessors are dealt round
+ * robin to the workers before the run starts.
+ *
+ *****************************************************************************/
+
+#if !defined( __MICROWORK_DAG_H_ )
+#define __MICROWORK_DAG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "microwork_inline.h"
+#include "microwork_hybrid.h"
+
+/* most workers in a pool */
+#define MW_DAG_MAX_WORKERS 256
+
+/* most PAUSEs between attempts to find work before an idle worker 
+   yields the cpu instead (override with -D when building microwork_dag.o) */
+#if !defined( MW_DAG_IDLE_PAUSE_MAX )
+#define MW_DAG_IDLE_PAUSE_MAX 1024
+#endif
+
+/* task kernels */
+typedef enum dag_kernel_e {
+  DAG_WORK, DAG_WAIT, DAG_ASM_NOP, DAG_ASM_MUL, DAG_ASM_FADD, DAG_ASM_FMUL, DAG_KERNEL_COUNT
+} dag_kernel_t;
+
+/* printable names, indexed by dag_kernel_t (as used in graph files) */
+#define DAG_KERNEL_NAMES { "work", "wait", "asm_nop", "asm_mul", "asm_fadd", "asm_fmul" }
+
+/* duration distributions */
+typedef enum dag_dist_e { DIST_FIXED, DIST_UNIFORM, DIST_NORMAL, DIST_EXP, DIST_COUNT } dag_dist_t;
+
+/* printable names, indexed by dag_dist_t (as used in graph files) */
+#define DAG_DIST_NAMES { "fixed", "uniform", "normal", "exp" }
+
+/* one task */
+typedef struct dag_task_s {
+  dag_kernel_t kernel;
+  dag_dist_t dist;
+  double p1, p2;            /* distribution parameters, nsecs */
+  uint64_t nsec;            /* sampled duration */
+  uint64_t loop_num;        /* loops (work) or cycles (asm_*) for nsec */
+  int num_pred;
+  int num_succ;
+  int succ_off;             /* first successor in mw_dag_t.succ */
+  int pending;              /* predecessors not yet complete, during a run */
+} dag_task_t;
+
+/* a task graph */
+typedef struct mw_dag_s {
+  int num_tasks;
+  int num_edges;
+  dag_task_t *tasks;
+  int *succ;                /* successor lists, indexed by succ_off */
+  int *order;               /* a topological order */
+  uint64_t critical_path_nsec;  /* set by mw_dag_sample */
+  uint64_t total_work_nsec;     /* set by mw_dag_sample */
+} mw_dag_t;
+
+/* what one worker did during a run */
+typedef struct mw_dag_worker_stats_s {
+  int cpu;                  /* cpu pinned to, or -1 */
+  uint64_t tasks;           /* tasks executed */
+  uint64_t steals;          /* tasks stolen from other workers */
+  uint64_t failed_steals;   /* steal attempts that found nothing or lost a race */
+  uint64_t busy_nsec;       /* time inside task bodies */
+  uint64_t idle_nsec;       /* everything else: finding, stealing, releasing */
+  uint64_t requested_nsec;  /* sum of the sampled durations it executed */
+} mw_dag_worker_stats_t;
+
+/* results of a run */
+typedef struct mw_dag_report_s {
+  int num_workers;
+  uint64_t makespan_nsec;
+  uint64_t critical_path_nsec;
+  uint64_t total_work_nsec;
+  mw_dag_worker_stats_t workers[MW_DAG_MAX_WORKERS];
+} mw_dag_report_t;
+
+/* Read a task graph file.
+ *
+ * Returns: 0 on success, -1 on a malformed or cyclic graph.
+ */
+int mw_dag_load(const char *path, mw_dag_t *dag);
+
+/* Build a random layered graph: num_layers layers of width tasks of
+ * the given kernel with exponential durations of mean_nsec, each task
+ * after the first layer depending on up to fan_in random tasks of the
+ * layer before.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int mw_dag_layered(int num_layers, int width, int fan_in, dag_kernel_t kernel, uint64_t mean_nsec,
+                   uint64_t seed, mw_dag_t *dag);
+
+/* Sample every task's duration, convert it to a loop count, and compute
+ * the critical path and total work.
+ *
+ * seed      : seed for the duration draws
+ * c_results : calibration of the work loop, for work tasks
+ * hybrid    : TSC rate for asm_* tasks
+ */
+void mw_dag_sample(mw_dag_t *dag, uint64_t seed, c_results_t *c_results, const mw_hybrid_t *hybrid);
+
+/* Run the graph on num_workers threads. Worker i is pinned to cpus[i]
+ * unless cpus is NULL or cpus[i] < 0. A worker that finds no work backs
+ * off with PAUSE, doubling up to MW_DAG_IDLE_PAUSE_MAX, and then yields the cpu.
+ *
+ * Returns: 0 on success, -1 on failure (workers already started are
+ * joined first).
+ */
+int mw_dag_run(mw_dag_t *dag, int num_workers, const int *cpus, const mw_hybrid_t *hybrid,
+               uint64_t seed, mw_dag_report_t *report);
+
+/* Free a graph from mw_dag_load() or mw_dag_layered(). */
+void mw_dag_free(mw_dag_t *dag);
+
+#endif /* __MICROWORK_DAG_H_ */
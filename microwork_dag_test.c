@@ -0,0 +1,235 @@
+/*****************************************************************************
+ *
+ * microwork_dag_test.c
+ *
+ * Runs a task graph (microwork_dag.h) on a work-stealing pool and
+ * reports the achieved makespan against its lower bounds:
+ *   - critical path: the longest chain of sampled task durations
+ *   - work bound: total sampled work divided by the number of workers
+ * plus, per worker, tasks run, steals, failed steal attempts, and time
+ * busy in task bodies vs idle (finding work, stealing, releasing
+ * successors). The gap between makespan and the larger bound is the
+ * cost of scheduling at this task grain.
+ *
+ * The graph is read from a file (-f) or generated as random layers
+ * (-L). Work tasks use the loop the binary was built with (mwd_*.x),
+ * calibrated before the run.
+ *
+ *****************************************************************************/
+
+#include "microwork_inline.h"
+#include "microwork_dag.h"
+#include "microwork_interfere.h"
+
+/* runtime options */
+typedef struct dag_opts_s {
+  char *graph_path;           /* NULL: generate layers */
+  int num_layers;
+  int width;
+  int fan_in;
+  dag_kernel_t kernel;        /* kernel of generated tasks */
+  uint64_t mean_nsec;         /* mean duration of generated tasks */
+  int num_workers;
+  int first_cpu;              /* < 0: do not pin */
+  uint64_t seed;
+  uint64_t cycles_per_trial;  /* calibration, if the graph has work tasks */
+  int num_trials;
+  int rest_mode;
+  int cal_points;
+  int verbose;
+} dag_opts_t;
+
+void usage(char **argv) {
+  printf("\n################################################################\n");
+  printf("Usage:\n");
+  printf("  %s (-f <graph> | -L <layers> -W <width> [-F <fan_in>] [-k <kernel>] -d <nsecs>) -j <workers>\n", argv[0]);
+  printf("        [-p <cpu>] [-S <seed>] [-c <cycles> -t <trials> -r <rest_mode> -m <points>] -v\n");
+  printf("\nWhere:\n");
+  printf("  -f <graph>   : task graph file (see microwork_dag.h)\n");
+  printf("  -L <layers>  : generate a random layered graph with this many layers\n");
+  printf("  -W <width>   : tasks per generated layer\n");
+  printf("  -F <fan_in>  : predecessors per generated task (optional; default 2)\n");
+  printf("  -k <kernel>  : kernel of generated tasks: work, wait, asm_nop, ... (optional; default work)\n");
+  printf("  -d <nsecs>   : mean duration of generated tasks (exponential)\n");
+  printf("  -j <workers> : number of worker threads (required)\n");
+  printf("  -p <cpu>     : pin worker i to the i-th online cpu from this one (optional; default no pinning)\n");
+  printf("  -S <seed>    : seed for durations, generation and victim choice (optional; default 1)\n");
+  printf("  -c <cycles>  : cycles per calibration trial for work tasks (optional; default 1000000)\n");
+  printf("  -t <trials>  : number of calibration trials (optional; default 5)\n");
+  printf("  -r <int>     : rest mode between calibration trials (optional; default 0)\n");
+  printf("                  0 = sleep(1)\n");
+  printf("                  1 = write to /dev/null\n");
+  printf("  -m <points>  : multi-point calibration (optional; see mit_*.x)\n");
+  printf("  -v           : verbose (optional)\n");
+  printf("################################################################");
+  printf("\n");
+  exit(-1);
+}
+
+int process_args(int argc, char **argv, dag_opts_t *opts) {
+  static const char *kernel_names[] = DAG_KERNEL_NAMES;
+  int c, k;
+  extern char *optarg;
+  extern int optopt;
+  int j_flag = 0;
+
+  opts->graph_path = NULL;
+  opts->num_layers = 0;
+  opts->width = 0;
+  opts->fan_in = 2;
+  opts->kernel = DAG_WORK;
+  opts->mean_nsec = 0;
+  opts->num_workers = 0;
+  opts->first_cpu = -1;
+  opts->seed = 1;
+  opts->cycles_per_trial = 1000000;
+  opts->num_trials = 5;
+  opts->rest_mode = 0;
+  opts->cal_points = 0;
+  opts->verbose = 0;
+
+  while ((c = getopt(argc, argv, "c:d:f:F:j:k:L:m:p:r:S:t:vW:")) != -1) {
+    switch(c)
+    {
+      case 'c': opts->cycles_per_trial = strtoull(optarg,NULL,10); break;
+      case 'd': opts->mean_nsec = strtoull(optarg,NULL,10); break;
+      case 'f': opts->graph_path = optarg; break;
+      case 'F': opts->fan_in = atoi(optarg); break;
+      case 'j': j_flag = 1; opts->num_workers = atoi(optarg); break;
+      case 'k':
+        for (k = 0; k < DAG_KERNEL_COUNT && strcmp(optarg, kernel_names[k]) != 0; k++);
+        if (k == DAG_KERNEL_COUNT) {
+          fprintf(stderr, "\nunknown kernel %s\n", optarg);
+          usage(argv);
+        }
+        opts->kernel = (dag_kernel_t)k;
+        break;
+      case 'L': opts->num_layers = atoi(optarg); break;
+      case 'm': opts->cal_points = atoi(optarg); break;
+      case 'p': opts->first_cpu = atoi(optarg); break;
+      case 'r': opts->rest_mode = atoi(optarg); break;
+      case 'S': opts->seed = strtoull(optarg,NULL,10); break;
+      case 't': opts->num_trials = atoi(optarg); break;
+      case 'v': opts->verbose = 1; break;
+      case 'W': opts->width = atoi(optarg); break;
+      case '?':
+        fprintf(stderr, "Unkown option -%c\n", optopt);
+        usage(argv);
+        break;
+      default:
+        usage(argv);
+        break;
+    }
+  }
+
+  if (!j_flag || opts->num_workers < 1) {
+    fprintf(stderr, "\n-j option required\n");
+    usage(argv);
+  }
+  if (opts->graph_path == NULL && (opts->num_layers < 1 || opts->width < 1 || opts->mean_nsec == 0)) {
+    fprintf(stderr, "\n-f, or -L, -W and -d, required\n");
+    usage(argv);
+  }
+  return 0;
+}
+
+/*
+ * Mr. Main
+ */
+int main(int argc, char **argv) {
+  static const char *kernel_names[] = WORK_KERNEL_NAMES;
+  dag_opts_t options;
+  mw_topology_t topo;
+  mw_hybrid_t hybrid;
+  mw_dag_t dag;
+  mw_dag_report_t *report;
+  c_results_t c_results;
+  int cpus[MW_DAG_MAX_WORKERS];
+  uint64_t steals = 0, failed = 0, busy = 0, idle = 0, requested = 0, work_bound, bound;
+  int i, c, has_work = 0;
+
+  process_args(argc, argv, &options);
+
+  if (options.graph_path != NULL) {
+    if (mw_dag_load(options.graph_path, &dag) != 0) return -1;
+  } else {
+    if (mw_dag_layered(options.num_layers, options.width, options.fan_in, options.kernel,
+                       options.mean_nsec, options.seed, &dag) != 0) return -1;
+  }
+  if (options.num_workers > MW_DAG_MAX_WORKERS) {
+    fprintf(stderr, "%s:%d: ERROR -- at most %d workers.\n", __FILE__, __LINE__, MW_DAG_MAX_WORKERS);
+    return -1;
+  }
+
+  /* worker i on the i-th online cpu from first_cpu */
+  for (i = 0; i < options.num_workers; i++) cpus[i] = -1;
+  if (options.first_cpu >= 0) {
+    if (mw_topology_read(&topo) != 0) return -1;
+    c = options.first_cpu;
+    for (i = 0; i < options.num_workers; i++) {
+      while (!topo.online[c % topo.num_cpus]) c++;
+      cpus[i] = c++ % topo.num_cpus;
+    }
+    mw_pin_self(cpus[0]);
+  }
+
+  /* TSC rate for asm_* tasks and the spin tail for wait tasks */
+  if (options.verbose) printf("Measuring TSC rate and wake latency:\n");
+  if (mw_hybrid_init(&hybrid, 0, 0) != 0) return -1;
+
+  /* calibrate the work loop if any task uses it */
+  memset(&c_results, 0, sizeof(c_results));
+  for (i = 0; i < dag.num_tasks; i++) has_work |= dag.tasks[i].kernel == DAG_WORK;
+  if (has_work) {
+    if (options.verbose) printf("Calibrating:\n");
+    if (options.cal_points > 1) {
+      calibrate_regression(options.num_trials, options.cycles_per_trial / 1024, options.cycles_per_trial,
+                           options.cal_points, options.rest_mode, options.verbose, &c_results);
+    } else {
+      calibrate(options.num_trials, options.cycles_per_trial, options.rest_mode, options.verbose, &c_results);
+    }
+  }
+
+  mw_dag_sample(&dag, options.seed, &c_results, &hybrid);
+
+  report = (mw_dag_report_t *)malloc(sizeof(*report));
+  if (report == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating report.\n", __FILE__, __LINE__);
+    return -1;
+  }
+  if (mw_dag_run(&dag, options.num_workers, cpus, &hybrid, options.seed, report) != 0) return -1;
+
+  work_bound = report->total_work_nsec / options.num_workers;
+  bound = report->critical_path_nsec > work_bound ? report->critical_path_nsec : work_bound;
+
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# graph             : %s\n", options.graph_path != NULL ? options.graph_path : "layered");
+  fprintf(stdout,"# work loop         : %s\n", kernel_names[WORK_KERNEL]);
+  fprintf(stdout,"# tasks             : %d\n", dag.num_tasks);
+  fprintf(stdout,"# edges             : %d\n", dag.num_edges);
+  fprintf(stdout,"# workers           : %d\n", options.num_workers);
+  fprintf(stdout,"# seed              : %lld\n", options.seed);
+  fprintf(stdout,"# total work nsec   : %lld\n", report->total_work_nsec);
+  fprintf(stdout,"# critical path nsec: %lld\n", report->critical_path_nsec);
+  fprintf(stdout,"# work bound nsec   : %lld\n", work_bound);
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# worker # cpu # tasks # steals # failed_steals # busy_nsec # idle_nsec # busy_vs_requested #\n");
+  for (i = 0; i < options.num_workers; i++) {
+    mw_dag_worker_stats_t *w = &report->workers[i];
+    fprintf(stdout, "%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\t%f\n", i, w->cpu, w->tasks, w->steals, w->failed_steals,
+        w->busy_nsec, w->idle_nsec, w->requested_nsec ? w->busy_nsec / (double)w->requested_nsec : 0.0);
+    steals += w->steals;
+    failed += w->failed_steals;
+    busy += w->busy_nsec;
+    idle += w->idle_nsec;
+    requested += w->requested_nsec;
+  }
+  fprintf(stdout,"# makespan_nsec # bound_nsec # makespan_vs_bound # steals # failed_steals # idle_fraction # busy_vs_requested #\n");
+  fprintf(stdout, "%lld\t%lld\t%f\t%lld\t%lld\t%f\t%f\n", report->makespan_nsec, bound,
+      bound ? report->makespan_nsec / (double)bound : 0.0, steals, failed,
+      busy + idle ? idle / (double)(busy + idle) : 0.0, requested ? busy / (double)requested : 0.0);
+
+  free(report);
+  mw_dag_free(&dag);
+  return 0;
+}
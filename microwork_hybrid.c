@@ -0,0 +1,119 @@
+/*****************************************************************************
+ *
+ * microwork_hybrid.c
+ *
+ * Hybrid sleep-then-spin waits. See microwork_hybrid.h.
+ *
+ *****************************************************************************/
+
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "microwork_hybrid.h"
+#include "microwork_inline_work.h"
+
+#define NSEC_PER_SEC 1000000000
+
+/* TSC read for the spin: LFENCE orders it after earlier loads without
+   the cost of CPUID, which traps under virtualization */
+static inline uint64_t spin_tsc() {
+  uint64_t hi, lo;
+  __asm__ __volatile__ ("LFENCE; RDTSC" : "=d" (hi), "=a" (lo));
+  return (hi << 32) | lo;
+}
+
+static inline uint64_t ts_nsec(const struct timespec *ts) {
+  return (uint64_t)ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static inline void nsec_ts(uint64_t nsec, struct timespec *ts) {
+  ts->tv_sec = nsec / NSEC_PER_SEC;
+  ts->tv_nsec = nsec % NSEC_PER_SEC;
+}
+
+/* sleep until the absolute CLOCK_MONOTONIC time until_nsec */
+static void sleep_until(uint64_t until_nsec) {
+  struct timespec until;
+  nsec_ts(until_nsec, &until);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+int mw_hybrid_init(mw_hybrid_t *hybrid, int num_samples, uint64_t tail_nsec) {
+  struct timespec now;
+  uint64_t *late, deadline;
+  int i;
+
+  if (num_samples < 1) num_samples = MW_HYBRID_SAMPLES_DEFAULT;
+
+  /* the default 50 usec timer slack would dominate the wake latency */
+  #if defined(__linux__) && defined(PR_SET_TIMERSLACK)
+    if (prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) != 0) {
+      fprintf(stderr, "%s:%d: WARNING: could not reduce timer slack; wake latency includes it\n", __FILE__, __LINE__);
+    }
+  #endif
+
+  hybrid->tsc_per_nsec = mw_measure_tsc_rate();
+  if (hybrid->tsc_per_nsec <= 0.0) {
+    fprintf(stderr, "%s:%d: ERROR -- could not measure the TSC rate.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  late = (uint64_t *)malloc(num_samples * sizeof(*late));
+  if (late == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating wake latency samples.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* how long after an absolute deadline does clock_nanosleep return? */
+  for (i = 0; i < num_samples; i++) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = ts_nsec(&now) + MW_HYBRID_PROBE_NSEC;
+    sleep_until(deadline);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late[i] = ts_nsec(&now) > deadline ? ts_nsec(&now) - deadline : 0;
+  }
+  qsort(late, num_samples, sizeof(*late), mw_cmp_u64);
+  hybrid->wake_p50 = late[num_samples / 2];
+  hybrid->wake_p99 = late[(num_samples * 99) / 100];
+  hybrid->wake_max = late[num_samples - 1];
+  free(late);
+
+  hybrid->tail_nsec = tail_nsec > 0 ? tail_nsec : hybrid->wake_p99 + MW_HYBRID_MARGIN_NSEC;
+  return 0;
+}
+
+void mw_hybrid_wait(const mw_hybrid_t *hybrid, uint64_t nsec, mw_hybrid_wait_t *what) {
+  struct timespec now;
+  uint64_t start_tsc, end_tsc, wake_tsc, start_nsec;
+
+  start_tsc = spin_tsc();
+  end_tsc = start_tsc + (uint64_t)(nsec * hybrid->tsc_per_nsec);
+  wake_tsc = start_tsc;
+
+  if (nsec > hybrid->tail_nsec) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    /* charge the clock read to the sleep */
+    start_nsec = ts_nsec(&now) - (uint64_t)((spin_tsc() - start_tsc) / hybrid->tsc_per_nsec);
+    sleep_until(start_nsec + nsec - hybrid->tail_nsec);
+    wake_tsc = spin_tsc();
+  }
+
+  while (spin_tsc() < end_tsc) __asm__ __volatile__ ("PAUSE");
+
+  if (what != NULL) {
+    what->slept_nsec = (uint64_t)((wake_tsc - start_tsc) / hybrid->tsc_per_nsec);
+    what->overshoot = wake_tsc >= end_tsc;
+    what->spun_nsec = what->overshoot ? 0 : (uint64_t)((end_tsc - wake_tsc) / hybrid->tsc_per_nsec);
+  }
+}
+
+void mw_hybrid_spin(const mw_hybrid_t *hybrid, uint64_t nsec) {
+  uint64_t end_tsc = spin_tsc() + (uint64_t)(nsec * hybrid->tsc_per_nsec);
+  while (spin_tsc() < end_tsc) __asm__ __volatile__ ("PAUSE");
+}
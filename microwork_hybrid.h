@@ -0,0 +1,72 @@
+/*****************************************************************************
+ *
+ * microwork_hybrid.h
+ *
+ * Hybrid sleep-then-spin waits, for long durations that model latency
+ * (e.g., waiting on simulated I/O) rather than cpu occupancy.
+ *
+ * A wait of nsec nanoseconds blocks in clock_nanosleep(TIMER_ABSTIME)
+ * until tail_nsec before the deadline, then spins on the TSC for the
+ * rest. The tail is tuned per host by mw_hybrid_init(), which measures
+ * how late clock_nanosleep wakes up and sets the tail to the p99 wake
+ * latency plus a margin, so the spin absorbs almost every late wake and
+ * the delivered duration is as accurate as a pure spin while the cpu is
+ * only busy for the tail.
+ *
+ * mw_hybrid_init() also sets the calling thread's timer slack to the
+ * minimum, so it should be called from the thread that waits.
+ *
+ * Waits no longer than the tail spin throughout.
+ *
+ *****************************************************************************/
+
+#if !defined( __MICROWORK_HYBRID_H_ )
+#define __MICROWORK_HYBRID_H_
+
+#include <stdint.h>
+
+/* default number of wake latency samples taken by mw_hybrid_init */
+#define MW_HYBRID_SAMPLES_DEFAULT 200
+
+/* length of each sampled sleep, in nsecs */
+#define MW_HYBRID_PROBE_NSEC 100000
+
+/* added to the p99 wake latency to give the spin tail, in nsecs */
+#define MW_HYBRID_MARGIN_NSEC 10000
+
+/* per-host tuning for hybrid waits */
+typedef struct mw_hybrid_s {
+  double tsc_per_nsec;      /* TSC rate, measured against CLOCK_MONOTONIC */
+  uint64_t wake_p50;        /* measured clock_nanosleep wake latency, nsecs */
+  uint64_t wake_p99;
+  uint64_t wake_max;
+  uint64_t tail_nsec;       /* spin for this long before each deadline */
+} mw_hybrid_t;
+
+/* what one wait did */
+typedef struct mw_hybrid_wait_s {
+  uint64_t slept_nsec;      /* time spent in clock_nanosleep */
+  uint64_t spun_nsec;       /* time spent spinning on the TSC */
+  int overshoot;            /* 1 if the sleep woke after the deadline */
+} mw_hybrid_wait_t;
+
+/* Measure the TSC rate and the wake latency of this host and set the
+ * spin tail. Run on the cpu the waits will use.
+ *
+ * num_samples : number of sleeps to sample (MW_HYBRID_SAMPLES_DEFAULT if < 1)
+ * tail_nsec   : fixed tail to use instead of the tuned one, or 0
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int mw_hybrid_init(mw_hybrid_t *hybrid, int num_samples, uint64_t tail_nsec);
+
+/* Wait nsec nanoseconds, sleeping until the tail and spinning after.
+ *
+ * what : if not NULL, filled in with how the wait was spent
+ */
+void mw_hybrid_wait(const mw_hybrid_t *hybrid, uint64_t nsec, mw_hybrid_wait_t *what);
+
+/* Wait nsec nanoseconds spinning throughout (the baseline for accuracy). */
+void mw_hybrid_spin(const mw_hybrid_t *hybrid, uint64_t nsec);
+
+#endif /* __MICROWORK_HYBRID_H_ */
@@ -0,0 +1,194 @@
+/*****************************************************************************
+ *
+ * microwork_hybrid_test.c
+ *
+ * Compares hybrid sleep-then-spin waits (microwork_hybrid.h) against a
+ * pure TSC spin of the same duration. After tuning the spin tail from
+ * the measured wake latency, each mode is run num_tests times and a row
+ * is printed with:
+ *   - error of the delivered duration (mean, p50/p99/max of |error|)
+ *   - cpu time consumed per wait (CLOCK_THREAD_CPUTIME_ID) and as a
+ *     fraction of the wait
+ *   - number of waits whose sleep woke after the deadline
+ *
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>   /* for getopt */
+
+#include "microwork_hybrid.h"
+#include "microwork_inline_work.h"
+#include "microwork_interfere.h"
+
+/* runtime options */
+typedef struct hybrid_opts_s {
+  uint64_t target_nsec;
+  int num_tests;
+  int num_samples;            /* wake latency samples */
+  uint64_t tail_nsec;         /* 0: tune from wake latency */
+  int cpu;
+  int verbose;
+} hybrid_opts_t;
+
+/* results of one wait mode */
+typedef struct hybrid_row_s {
+  double mean_err;
+  uint64_t p50_abs_err;
+  uint64_t p99_abs_err;
+  uint64_t max_abs_err;
+  double cpu_nsec;            /* mean cpu time per wait */
+  int overshoots;
+} hybrid_row_t;
+
+void usage(char **argv) {
+  printf("\n################################################################\n");
+  printf("Usage:\n");
+  printf("  %s -d <nsecs> -n <tests> [-s <samples>] [-T <nsecs>] [-p <cpu>] -v\n", argv[0]);
+  printf("\nWhere:\n");
+  printf("  -d <nsecs>   : duration of each wait (required)\n");
+  printf("  -n <tests>   : number of waits per mode (required)\n");
+  printf("  -s <samples> : wake latency samples for tuning the tail (optional; default %d)\n", MW_HYBRID_SAMPLES_DEFAULT);
+  printf("  -T <nsecs>   : use this spin tail instead of the tuned one (optional)\n");
+  printf("  -p <cpu>     : cpu to wait on (optional; default 0)\n");
+  printf("  -v           : verbose (optional)\n");
+  printf("################################################################");
+  printf("\n");
+  exit(-1);
+}
+
+int process_args(int argc, char **argv, hybrid_opts_t *opts) {
+  int c;
+  extern char *optarg;
+  extern int optopt;
+  int d_flag = 0, n_flag = 0;
+
+  opts->target_nsec = 0;
+  opts->num_tests = 0;
+  opts->num_samples = MW_HYBRID_SAMPLES_DEFAULT;
+  opts->tail_nsec = 0;
+  opts->cpu = 0;
+  opts->verbose = 0;
+
+  while ((c = getopt(argc, argv, "d:n:p:s:T:v")) != -1) {
+    switch(c)
+    {
+      case 'd': d_flag = 1; opts->target_nsec = strtoull(optarg,NULL,10); break;
+      case 'n': n_flag = 1; opts->num_tests = atoi(optarg); break;
+      case 'p': opts->cpu = atoi(optarg); break;
+      case 's': opts->num_samples = atoi(optarg); break;
+      case 'T': opts->tail_nsec = strtoull(optarg,NULL,10); break;
+      case 'v': opts->verbose = 1; break;
+      case '?':
+        fprintf(stderr, "Unkown option -%c\n", optopt);
+        usage(argv);
+        break;
+      default:
+        usage(argv);
+        break;
+    }
+  }
+
+  if (!d_flag || !n_flag) {
+    fprintf(stderr, "\n-d and -n options required\n");
+    usage(argv);
+  }
+  if (opts->num_tests < 1) usage(argv);
+  return 0;
+}
+
+static uint64_t clock_nsec(clockid_t id) {
+  struct timespec ts;
+  clock_gettime(id, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* run num_tests waits in one mode */
+static void run_tests(const hybrid_opts_t *opts, const mw_hybrid_t *hybrid, int use_hybrid,
+                      uint64_t *results, hybrid_row_t *row) {
+  mw_hybrid_wait_t what;
+  uint64_t start, end, cpu_start, cpu_sum = 0;
+  double sum_err = 0.0, err;
+  int t;
+
+  row->overshoots = 0;
+  for (t = 0; t < opts->num_tests; t++) {
+    cpu_start = clock_nsec(CLOCK_THREAD_CPUTIME_ID);
+    start = clock_nsec(CLOCK_MONOTONIC);
+    if (use_hybrid) {
+      mw_hybrid_wait(hybrid, opts->target_nsec, &what);
+      row->overshoots += what.overshoot;
+    } else {
+      mw_hybrid_spin(hybrid, opts->target_nsec);
+    }
+    end = clock_nsec(CLOCK_MONOTONIC);
+    cpu_sum += clock_nsec(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    results[t] = end - start;
+  }
+
+  for (t = 0; t < opts->num_tests; t++) {
+    err = (double)results[t] - (double)opts->target_nsec;
+    sum_err += err;
+    results[t] = (uint64_t)fabs(err);
+  }
+  qsort(results, opts->num_tests, sizeof(*results), mw_cmp_u64);
+  row->mean_err = sum_err / opts->num_tests;
+  row->p50_abs_err = results[opts->num_tests / 2];
+  row->p99_abs_err = results[(opts->num_tests * 99) / 100];
+  row->max_abs_err = results[opts->num_tests - 1];
+  row->cpu_nsec = cpu_sum / (double)opts->num_tests;
+}
+
+/*
+ * Mr. Main
+ */
+int main(int argc, char **argv) {
+  static const char *mode_names[] = { "spin", "hybrid" };
+  hybrid_opts_t options;
+  mw_hybrid_t hybrid;
+  hybrid_row_t rows[2];
+  uint64_t *results;
+  int m;
+
+  process_args(argc, argv, &options);
+
+  if (mw_pin_self(options.cpu) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: could not pin waits to cpu %d\n", __FILE__, __LINE__, options.cpu);
+  }
+
+  if (options.verbose) printf("Measuring wake latency:\n");
+  if (mw_hybrid_init(&hybrid, options.num_samples, options.tail_nsec) != 0) return -1;
+
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# target_nsec       : %lld\n", options.target_nsec);
+  fprintf(stdout,"# num_tests         : %d\n", options.num_tests);
+  fprintf(stdout,"# cpu               : %d\n", options.cpu);
+  fprintf(stdout,"# tsc_per_nsec      : %f\n", hybrid.tsc_per_nsec);
+  fprintf(stdout,"# wake latency p50  : %lld\n", hybrid.wake_p50);
+  fprintf(stdout,"# wake latency p99  : %lld\n", hybrid.wake_p99);
+  fprintf(stdout,"# wake latency max  : %lld\n", hybrid.wake_max);
+  fprintf(stdout,"# spin tail         : %lld%s\n", hybrid.tail_nsec, options.tail_nsec ? " (fixed)" : "");
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# mode # mean_err_nsec # p50_abs_err # p99_abs_err # max_abs_err # cpu_nsec # cpu_fraction # overshoots #\n");
+
+  results = (uint64_t *)malloc(options.num_tests * sizeof(*results));
+  if (results == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating results.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  for (m = 0; m < 2; m++) {
+    run_tests(&options, &hybrid, m, results, &rows[m]);
+    fprintf(stdout, "%s\t%f\t%lld\t%lld\t%lld\t%f\t%f\t%d\n", mode_names[m],
+        rows[m].mean_err, rows[m].p50_abs_err, rows[m].p99_abs_err, rows[m].max_abs_err,
+        rows[m].cpu_nsec, options.target_nsec ? rows[m].cpu_nsec / options.target_nsec : 0.0,
+        rows[m].overshoots);
+    fflush(stdout);
+  }
+
+  free(results);
+  return 0;
+}
@@ -19,22 +19,46 @@
 
 #include "microwork_inline.h"
 
+/* WORK_MEM buffer */
+uint64_t *work_buf = NULL;
+uint64_t work_buf_lines = 0;
+
+/* allocate the default WORK_MEM buffer if none has been set */
+static void default_work_buffer() {
+  #if defined( WORK_MEM )
+    if (work_buf == NULL) {
+      uint64_t *buf = NULL;
+      if (posix_memalign((void **)&buf, 64, WORK_BUF_DEFAULT_BYTES) != 0) {
+        fprintf(stderr, "%s:%d: ERROR -- failure allocating work buffer.\n", __FILE__, __LINE__);
+        exit(-1);
+      }
+      memset(buf, 0, WORK_BUF_DEFAULT_BYTES);
+      set_work_buffer(buf, WORK_BUF_DEFAULT_BYTES);
+    }
+  #endif
+}
+
+int set_work_buffer(uint64_t *buf, uint64_t bytes) {
+  uint64_t lines = bytes / (_WORK_LINE_WORDS * sizeof(uint64_t));
+
+  /* WORK_MEM_C wraps at work_buf_lines, so it must be at least one */
+  if (buf != NULL && lines == 0) {
+    fprintf(stderr, "%s:%d: ERROR -- work buffer of %lld bytes holds no 64 byte line.\n", __FILE__, __LINE__, bytes);
+    return -1;
+  }
+  work_buf = buf;
+  work_buf_lines = buf != NULL ? lines : 0;
+  return 0;
+}
+
 /*****************************************************************************
  * CALIBRATION 
  *****************************************************************************/
 
-/* 
- * num_trials : number of trials to use during calibration
- * cycles_per_trial : number of cycles to use for each trial. ignored 
- *    if work is MXM
- * rest_type : type of rest to perform between trials
- * verbose : if > 1, then babble
- * stats_ptr : pointer to stats struct wherein to store results
- *
+/*
+ * Perform the configured work loop once and return elapsed nsecs.
  */
-void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int verbose, c_results_t *c_results_ptr) {
-  
-  int t;
+uint64_t timed_work(uint64_t loop_num) {
 
   /* for measuring times */
   struct timespec start,end;
@@ -45,7 +69,57 @@ void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int
     host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
   #endif
 
-  /* fill in default results */
+  default_work_buffer();
+
+  /* get start of trial timestamp */
+  #if defined(__MACH__)
+    clock_get_time(cclock, &mts_start);
+  #else
+    if ( clock_gettime( CLOCK_MONOTONIC, &start ) == -1 ) {
+      fprintf(stderr, "%s:%d: Failure getting start clock time.\n", __FILE__, __LINE__);
+      return 0;
+    }
+  #endif
+
+  #if defined( WORK_NULL )
+    WORK_NULL_C
+  #elif defined( WORK_MXM )
+    WORK_MXM_C
+  #elif defined( WORK_ASM_NOP )
+    WORK_ASM_NOP_C
+  #elif defined( WORK_ASM_MUL )
+    WORK_ASM_MUL_C
+  #elif defined( WORK_ASM_FADD )
+    WORK_ASM_FADD_C
+  #elif defined( WORK_ASM_FMUL )
+    WORK_ASM_FMUL_C
+  #elif defined( WORK_MEM )
+    WORK_MEM_C
+  #else
+    fprintf(stderr, "%s:%d: ERROR -- unknown work type.\n", __FILE__, __LINE__);
+    WORK_NULL_C
+  #endif
+
+  /* get end of trial timestamp */
+  #if defined(__MACH__)
+    clock_get_time(cclock, &mts_end);
+    start.tv_sec = mts_start.tv_sec;
+    start.tv_nsec = mts_start.tv_nsec;
+    end.tv_sec = mts_end.tv_sec;
+    end.tv_nsec = mts_end.tv_nsec;
+    mach_port_deallocate(mach_task_self(), cclock);
+  #else
+    if ( clock_gettime( CLOCK_MONOTONIC, &end ) == -1 ) {
+      fprintf(stderr, "%s:%d: Failure getting end clock time.\n", __FILE__, __LINE__);
+      return 0;
+    }
+  #endif
+
+  return timespec_sub(&start, &end);
+}
+
+/* fill in default calibration results */
+static void init_results(uint64_t cycles_per_trial, c_results_t *c_results_ptr) {
   c_results_ptr->average = 0.0;
   c_results_ptr->std_dev = 0.0;
   c_results_ptr->min = 0;
@@ -53,8 +127,30 @@ void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int
   c_results_ptr->calibration_cycles = cycles_per_trial;
   c_results_ptr->target_nsec = 0;
   c_results_ptr->loop_num = 0;
+  c_results_ptr->model = CAL_PROPORTIONAL;
+  c_results_ptr->slope = 0.0;
+  c_results_ptr->intercept = 0.0;
+}
+
+/* 
+ * num_trials : number of trials to use during calibration
+ * cycles_per_trial : number of cycles to use for each trial. ignored 
+ *    if work is MXM
+ * rest_type : type of rest to perform between trials
+ * verbose : if > 1, then babble
+ * stats_ptr : pointer to stats struct wherein to store results
+ *
+ */
+void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int verbose, c_results_t *c_results_ptr) {
+  
+  int t;
+  uint64_t duration;
+
+  /* fill in default results */
+  init_results(cycles_per_trial, c_results_ptr);
 
   #if defined( WORK_NULL )
+    int loop_num = 0;
     uint64_t *results = NULL;
     return;
   #elif defined( WORK_MXM )
@@ -63,8 +159,13 @@ void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int
   #elif defined( WORK_ASM_NOP ) || defined( WORK_ASM_MUL ) || defined( WORK_ASM_FADD ) || defined( WORK_ASM_FMUL )
     int loop_num = cycles_per_trial; /* calibrate on cycles_per_trial per trial */
     uint64_t *results = (uint64_t *)malloc(num_trials * sizeof(*results)); 
+  #elif defined( WORK_MEM )
+    uint64_t loop_num = cycles_per_trial; /* calibrate on cycles_per_trial lines per trial */
+    uint64_t *results = (uint64_t *)malloc(num_trials * sizeof(*results)); 
+    default_work_buffer();
   #else
     /* the variable defined during compilation was not recognized, so print a warning and treat it like WORK_NULL */
+    int loop_num = 0;
     uint64_t *results = NULL;
     fprintf(stderr, "%s:%d: ERROR -- unknown work type.\n", __FILE__, __LINE__);
     return;
@@ -75,83 +176,142 @@ void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int
      This result is typically shorter than the others, so we discard it. */
   for (t = 0; t < num_trials+1; t++) {
 
-    /* get start of trial timestamp */
-    #if defined(__MACH__)
-      clock_get_time(cclock, &mts_start);
-    #else
-      if ( clock_gettime( CLOCK_MONOTONIC, &start ) == -1 ) {
-        fprintf(stderr, "%s:%d: Failure getting start clock time.\n", __FILE__, __LINE__);
-        return(-1);
-      }
-    #endif
-
-    #if defined( WORK_NULL )
-      WORK_NULL_C
-    #elif defined( WORK_MXM )
-      WORK_MXM_C
-    #elif defined( WORK_ASM_NOP )
-      WORK_ASM_NOP_C
-    #elif defined( WORK_ASM_MUL )
-      WORK_ASM_MUL_C
-    #elif defined( WORK_ASM_FADD )
-      WORK_ASM_FADD_C
-    #elif defined( WORK_ASM_FMUL )
-      WORK_ASM_FMUL_C
-    #else
-      fprintf(stderr, "%s:%d: ERROR -- unknown work type.\n", __FILE__, __LINE__);
-      WORK_NULL_C
-    #endif
-
-    /* get end of trial timestamp */
-    #if defined(__MACH__)
-      clock_get_time(cclock, &mts_end);
-      start.tv_sec = mts_start.tv_sec;
-      start.tv_nsec = mts_start.tv_nsec;
-      end.tv_sec = mts_end.tv_sec;
-      end.tv_nsec = mts_end.tv_nsec;
-    #else
-      if ( clock_gettime( CLOCK_MONOTONIC, &end ) == -1 ) {
-        fprintf(stderr, "%s:%d: Failure getting end clock time.\n", __FILE__, __LINE__);
-        return(-1);
-      }
-    #endif
+    duration = timed_work(loop_num);
     
     if (t > 0) {
-      results[t-1] = timespec_sub(&start, &end);
+      results[t-1] = duration;
       if (verbose) printf("Calibration Trial %d: %lld\t", t, results[t-1]);
     }
 
-    /* rest */
-    switch (rest_type) {
-      case REST_SLEEP:
-        if (verbose && t > 0) printf("(sleep(1))\n");
-        sleep(1);
-        break;
-      case REST_DEV_NULL:
-        if (verbose && t > 0) printf("(rest_dev_null(...))\n");
-        rest_dev_null(SLEEP_CYCLES);
-        break;
-      default:
-        fprintf(stderr, "%s:%d: ERROR -- unknown rest type.\n", __FILE__, __LINE__);
-        sleep(1);
-    }
+    rest(rest_type, verbose && t > 0);
   }
 
-  /* clean up mach clock if needed */
-  #if defined(__MACH__)
-    mach_port_deallocate(mach_task_self(), cclock);
-  #endif
-  
   /* fill in results structure */
   calc_stats(results, num_trials, c_results_ptr);
 
   free(results);
 }
+
+/* for qsort */
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/* median of an array of doubles; reorders the array */
+static double median_double(double *data, int length) {
+  qsort(data, length, sizeof(*data), cmp_double);
+  return length % 2 ? data[length/2] : (data[length/2 - 1] + data[length/2]) / 2.0;
+}
+
+/*
+ * Multi-point calibration: sample loop counts on a log scale and fit 
+ * duration = intercept + slope * loop_num through the per-point medians.
+ */
+void calibrate_regression(int num_trials, uint64_t min_loops, uint64_t max_loops, int num_points, rest_t rest_type, int verbose, c_results_t *c_results_ptr) {
+
+  int p, t, n = 0;
+  uint64_t loops, prev_loops = 0, last_loops = 0;
+
+  init_results(max_loops, c_results_ptr);
+
+  #if defined( WORK_NULL )
+    return;
+  #elif !defined( WORK_MXM ) && !defined( WORK_ASM_NOP ) && !defined( WORK_ASM_MUL ) && !defined( WORK_ASM_FADD ) && !defined( WORK_ASM_FMUL ) && !defined( WORK_MEM )
+    fprintf(stderr, "%s:%d: ERROR -- unknown work type.\n", __FILE__, __LINE__);
+    return;
+  #endif
+
+  if (min_loops < 1) min_loops = 1;
+  if (num_points < 2 || max_loops <= min_loops || num_trials < 1) {
+    fprintf(stderr, "%s:%d: WARNING: need >= 2 points and min_loops < max_loops; using single-point calibration\n", __FILE__, __LINE__);
+    calibrate(num_trials, max_loops, rest_type, verbose, c_results_ptr);
+    return;
+  }
+
+  default_work_buffer();
+
+  uint64_t *results = (uint64_t *)malloc(num_trials * sizeof(*results));
+  uint64_t *last = (uint64_t *)malloc(num_trials * sizeof(*last));
+  double *x = (double *)malloc(num_points * sizeof(*x));
+  double *y = (double *)malloc(num_points * sizeof(*y));
+
+  /* discard a first trial, as calibrate() does */
+  timed_work(min_loops);
+  rest(rest_type, 0);
+
+  for (p = 0; p < num_points; p++) {
+    loops = (uint64_t)llround(min_loops * pow(max_loops / (double)min_loops, p / (double)(num_points - 1)));
+    if (loops == prev_loops) continue;  /* small ranges of MXM iterations repeat */
+    prev_loops = loops;
+
+    for (t = 0; t < num_trials; t++) {
+      results[t] = timed_work(loops);
+      if (verbose) printf("Calibration Point %llu Trial %d: %lld\t", loops, t+1, results[t]);
+      rest(rest_type, verbose);
+    }
+
+    /* keep the largest point measured for the single-point statistics */
+    memcpy(last, results, num_trials * sizeof(*last));
+    last_loops = loops;
+
+    qsort(results, num_trials, sizeof(*results), mw_cmp_u64);
+    x[n] = (double)loops;
+    y[n] = num_trials % 2 ? results[num_trials/2] : (results[num_trials/2 - 1] + results[num_trials/2]) / 2.0;
+    n++;
+  }
+
+  /* the last point can be skipped as a repeat, so use the last one measured */
+  calc_stats(last, num_trials, c_results_ptr);
+  c_results_ptr->calibration_cycles = last_loops;
+
+  if (n >= 2) {
+    fit_theil_sen(x, y, n, &c_results_ptr->slope, &c_results_ptr->intercept);
+    if (c_results_ptr->slope > 0.0) {
+      c_results_ptr->model = CAL_LINEAR;
+    } else {
+      fprintf(stderr, "%s:%d: WARNING: non-positive calibration slope; using single-point model\n", __FILE__, __LINE__);
+    }
+  }
+
+  #if defined( WORK_MXM )
+    /* the single-point model for MXM expects nsecs per multiplication */
+    if (c_results_ptr->model != CAL_LINEAR && last_loops > 1) {
+      c_results_ptr->average /= last_loops;
+      c_results_ptr->std_dev /= last_loops;
+      c_results_ptr->min /= last_loops;
+      c_results_ptr->max /= last_loops;
+    }
+  #endif
+  if (verbose) printf("Calibration fit: duration = %f + %f * loops (%d points)\n", c_results_ptr->intercept, c_results_ptr->slope, n);
+
+  free(results);
+  free(last);
+  free(x);
+  free(y);
+}
   
 /*******************************************************************
  * RESTING METHODS in addition to sleep(1)
  *******************************************************************/
 
+/* rest using the given method */
+void rest(rest_t rest_type, int verbose) {
+  switch (rest_type) {
+    case REST_SLEEP:
+      if (verbose) printf("(sleep(1))\n");
+      sleep(1);
+      break;
+    case REST_DEV_NULL:
+      if (verbose) printf("(rest_dev_null(...))\n");
+      rest_dev_null(SLEEP_CYCLES);
+      break;
+    default:
+      fprintf(stderr, "%s:%d: ERROR -- unknown rest type.\n", __FILE__, __LINE__);
+      sleep(1);
+  }
+}
+
 /* rest by printing to dev/null */
 void rest_dev_null( uint32_t iters ) {
   uint64_t j;    
@@ -184,7 +344,7 @@ uint64_t timespec_sub( struct timespec *a, struct timespec *b)
  * Calculate statistics for array of nsec timings 
  */
 void calc_stats(const uint64_t *data, int length, c_results_t *c_results_ptr) {
-  uint64_t sum = 0, min, max;
+  uint64_t sum = 0;
   double v = 0.0;
   int i;
  
@@ -227,6 +387,17 @@ uint64_t calc_loop_num(uint64_t target_nsec, c_results_t *c_results_ptr) {
     return 0;
   }
   
+  /* multi-point calibration: remove the fixed cost before scaling */
+  if (c_results_ptr->model == CAL_LINEAR) {
+    if (target_nsec <= c_results_ptr->intercept) {
+      /* the fixed cost alone meets the target */
+      c_results_ptr->loop_num = 0;
+    } else {
+      c_results_ptr->loop_num = (uint64_t)((target_nsec - c_results_ptr->intercept) / c_results_ptr->slope);
+    }
+    return c_results_ptr->loop_num;
+  }
+
   /* truncate average nsec */
   uint64_t avg_nsec = c_results_ptr->average;
 
@@ -240,7 +411,7 @@ uint64_t calc_loop_num(uint64_t target_nsec, c_results_t *c_results_ptr) {
   #if defined( WORK_MXM )
     /* Since MXM is calibrated using a single matrix multiplication ... */
     c_results_ptr->loop_num = target_nsec/avg_nsec;
-  #elif defined( WORK_ASM_NOP ) || defined( WORK_ASM_MUL ) || defined( WORK_ASM_MUL ) || defined( WORK_ASM_FADD ) || defined( WORK_ASM_FMUL )
+  #elif defined( WORK_ASM_NOP ) || defined( WORK_ASM_MUL ) || defined( WORK_ASM_MUL ) || defined( WORK_ASM_FADD ) || defined( WORK_ASM_FMUL ) || defined( WORK_MEM )
     /* Assumption: number of cycles is a linear function of the time requested */
     c_results_ptr->loop_num = (uint64_t)((target_nsec/(long double)avg_nsec) * c_results_ptr->calibration_cycles);
   #else
@@ -252,6 +423,27 @@ uint64_t calc_loop_num(uint64_t target_nsec, c_results_t *c_results_ptr) {
   return c_results_ptr->loop_num;
 }
 
+/*
+ * Theil-Sen line fit: slope is the median of the pairwise slopes, 
+ * intercept the median of the residuals y - slope * x.
+ */
+void fit_theil_sen(const double *x, const double *y, int n, double *slope, double *intercept) {
+  int i, j, k = 0;
+  double *s = (double *)malloc((n * (n - 1) / 2 + n) * sizeof(*s));
+
+  for (i = 0; i < n; i++) {
+    for (j = i + 1; j < n; j++) {
+      if (x[j] != x[i]) s[k++] = (y[j] - y[i]) / (x[j] - x[i]);
+    }
+  }
+  *slope = k ? median_double(s, k) : 0.0;
+
+  for (i = 0; i < n; i++) s[i] = y[i] - *slope * x[i];
+  *intercept = median_double(s, n);
+
+  free(s);
+}
+
 /* 
  * Strip data points outside of num_std_dev standard deviations from in_data. 
  */
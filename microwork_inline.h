@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -30,6 +31,31 @@
 /* include the work loops */
 #include "microwork_inline_work.h"
 
+/* identifier of the work loop selected at compile time */
+#if defined( WORK_NULL )
+  #define WORK_KERNEL KERNEL_NULL
+#elif defined( WORK_MXM )
+  #define WORK_KERNEL KERNEL_MXM
+#elif defined( WORK_ASM_NOP )
+  #define WORK_KERNEL KERNEL_ASM_NOP
+#elif defined( WORK_ASM_MUL )
+  #define WORK_KERNEL KERNEL_ASM_MUL
+#elif defined( WORK_ASM_FADD )
+  #define WORK_KERNEL KERNEL_ASM_FADD
+#elif defined( WORK_ASM_FMUL )
+  #define WORK_KERNEL KERNEL_ASM_FMUL
+#elif defined( WORK_MEM )
+  #define WORK_KERNEL KERNEL_MEM
+#else
+  #define WORK_KERNEL KERNEL_NULL
+#endif
+
+/* calibration models used by calc_loop_num */
+typedef enum cal_model_e {
+  CAL_PROPORTIONAL,   /* loop_num = target_nsec / average * calibration_cycles */
+  CAL_LINEAR          /* loop_num = (target_nsec - intercept) / slope */
+} cal_model_t;
+
 /* calibration results */
 typedef struct c_results_s {
   double average;
@@ -39,6 +65,9 @@ typedef struct c_results_s {
   uint64_t calibration_cycles;  /* number of cycles used for each calibration trial */
   uint64_t target_nsec; /* number of nsecs used to calculate loop_num */
   uint64_t loop_num;    /* number of loops (MXM) or cycles (ASM) required to elapse target_nsec nanoseconds */ 
+  cal_model_t model;    /* how calc_loop_num converts target_nsec to loop_num */
+  double slope;         /* CAL_LINEAR: nsecs per loop (MXM) or cycle (ASM) */
+  double intercept;     /* CAL_LINEAR: fixed nsecs per invocation, e.g., entry CPUID/RDTSC and clock reads */
 } c_results_t;
 
 /* rest types */
@@ -51,6 +80,13 @@ typedef enum rest_e {REST_SLEEP, REST_DEV_NULL} rest_t;
 /* when using rest method besides sleep(1), perform the wait using this number of iterations */
 #define SLEEP_CYCLES 10000000
 
+/* WORK_MEM: buffer used if none is set with set_work_buffer() */
+#define WORK_BUF_DEFAULT_BYTES (64 * 1024 * 1024)
+
+/* WORK_MEM: buffer touched by the work loop (see WORK_MEM_C) */
+extern uint64_t *work_buf;
+extern uint64_t work_buf_lines;
+
 /*******************************************************************
  * UTILITY METHODS
  *******************************************************************/
@@ -85,16 +121,63 @@ uint64_t calc_loop_num(uint64_t target_nsec, c_results_t *c_results);
  */ 
 int strip_std_dev( const uint64_t *in_data, int in_length, int num_std_dev, int verbose, uint64_t *out_data);
 
+/* Fit duration = intercept + slope * x with the Theil-Sen estimator 
+ * (median of pairwise slopes), which tolerates outlying points.
+ *
+ * x, y       : sample points
+ * n          : number of points (>= 2)
+ * slope      : returned slope
+ * intercept  : returned intercept (median of y - slope * x)
+ */
+void fit_theil_sen(const double *x, const double *y, int n, double *slope, double *intercept);
+
+/* Set the buffer used by WORK_MEM, e.g., one placed on a particular 
+ * NUMA node. Calibrate after changing it.
+ *
+ * buf   : buffer, 64 byte aligned; NULL unsets it
+ * bytes : size of buf, at least one 64 byte line
+ *
+ * Returns: 0 on success, -1 (buffer unchanged) if buf holds no line.
+ */
+int set_work_buffer(uint64_t *buf, uint64_t bytes);
+
 /*******************************************************************
  * CALIBRATION (configured at compile time)
  *******************************************************************/
 
 void calibrate(int num_trials, uint64_t cycles_per_trial, rest_t rest_type, int versbose, c_results_t *c_results);
 
+/* Multi-point calibration. Times num_trials trials at each of num_points 
+ * loop counts spaced on a log scale between min_loops and max_loops, and 
+ * fits a linear model with an intercept to the per-point medians, so 
+ * fixed per-invocation costs are not scaled into short requests.
+ *
+ * min_loops  : smallest loop count (iterations for MXM, cycles for ASM)
+ * max_loops  : largest loop count; average/std_dev/min/max describe the 
+ *              largest point measured (per multiplication for MXM when 
+ *              the fit falls back to CAL_PROPORTIONAL)
+ * num_points : number of loop counts to sample (>= 2)
+ *
+ * On success c_results->model is CAL_LINEAR; if no usable fit is found it 
+ * is left as CAL_PROPORTIONAL using the max_loops point.
+ */
+void calibrate_regression(int num_trials, uint64_t min_loops, uint64_t max_loops, int num_points, rest_t rest_type, int verbose, c_results_t *c_results);
+
+/* Perform the configured work loop once.
+ *
+ * loop_num : number of loops (MXM) or cycles (ASM)
+ *
+ * Returns: elapsed nanoseconds, or 0 if the clock could not be read.
+ */
+uint64_t timed_work(uint64_t loop_num);
+
 /*******************************************************************
  * RESTING METHODS
  *******************************************************************/
 
 void rest_dev_null(uint32_t iters);
 
+/* Rest using the given method, e.g., between calibration trials. */
+void rest(rest_t rest_type, int verbose);
+
 #endif  /* __MICROWORK_INLINE_H_ */
@@ -19,7 +19,7 @@
 void usage(char **argv) {
   printf("\n################################################################\n");
   printf("Usage:\n");
-  printf("  %s -c <cycles> -t <trials> -d <nsecs> -n <tests> -r <rest_mode> -v\n", argv[0]);
+  printf("  %s -c <cycles> -t <trials> -d <nsecs> -n <tests> -r <rest_mode> [-m <points> [-s <loops>]] [-l <file> [-w <cpu>]] [-N <placement> -B <bytes> -p <cpu>] [-g <cycles> -P <policy>] -v\n", argv[0]);
   printf("\nWhere:\n");
   printf("  -c <cycles> : number of cycles per calibration trial (required but ignored if work method is WORK_MXM)\n");
   printf("  -d <nsecs>  : duration of each test (required)\n");
@@ -28,6 +28,20 @@ void usage(char **argv) {
   printf("  -r <int>    : rest mode for between trials and tests (required)\n");
   printf("                  0 = sleep(1)\n");
   printf("                  1 = write to /dev/null\n");
+  printf("  -m <points> : multi-point calibration fitting a fixed cost plus a per-loop cost over\n");
+  printf("                <points> loop counts log-spaced up to -c (iterations if WORK_MXM) (optional)\n");
+  printf("  -s <loops>  : smallest loop count for -m (optional; default -c / 1024)\n");
+  printf("  -l <file>   : write per-test TSC timing records to binary log <file> (optional)\n");
+  printf("  -w <cpu>    : pin the log writer thread to <cpu> (optional; default unpinned)\n");
+  printf("  -N <int>    : WORK_MEM only: work buffer placement (optional; default 0)\n");
+  printf("                  0 = NUMA node of the work cpu\n");
+  printf("                  1 = another NUMA node (local if there is only one)\n");
+  printf("  -B <bytes>  : WORK_MEM only: work buffer size (optional; default %d)\n", WORK_BUF_DEFAULT_BYTES);
+  printf("  -p <cpu>    : WORK_MEM only: cpu to calibrate and run on (optional; default 0)\n");
+  printf("  -g <cycles> : WORK_GAP_DETECT only: TSC steps longer than this are gaps (optional; default %d)\n", GAP_THRESHOLD_DEFAULT);
+  printf("  -P <int>    : WORK_GAP_DETECT only: gap policy (optional; default 0)\n");
+  printf("                  0 = wall time: stop at the deadline\n");
+  printf("                  1 = cpu work: extend the deadline by each gap\n");
   printf("  -v          : verbose (optional)\n");
   printf("################################################################");
   printf("\n");
@@ -52,9 +66,24 @@ int process_args( int argc, char **argv, optargs_t *opts) {
   /* set options defaults */
   set_default_options(opts);
 
-  while ((c = getopt(argc, argv, "c:d:n:r:t:v")) != -1) {
+  while ((c = getopt(argc, argv, "B:c:d:g:l:m:n:N:p:P:r:s:t:vw:")) != -1) {
     switch(c) 
     {  
+      case 'B': /* work buffer size */
+        opts->buf_bytes = strtoull(optarg,NULL,10);
+        break;
+      case 'g': /* gap threshold */
+        opts->gap_threshold = strtoull(optarg,NULL,10);
+        break;
+      case 'P': /* gap policy */
+        opts->gap_policy = atoi(optarg);
+        break;
+      case 'N': /* work buffer placement */
+        opts->numa_placement = atoi(optarg);
+        break;
+      case 'p': /* work cpu */
+        opts->work_cpu = atoi(optarg);
+        break;
       case 'c': /* number of cycles per trial */
         c_flag = 1;
         opts->cycles_per_trial = strtoull(optarg,NULL,10);
@@ -63,6 +92,15 @@ int process_args( int argc, char **argv, optargs_t *opts) {
         d_flag = 1;
         opts->target_nsec = strtoull(optarg,NULL,10);
         break;
+      case 'l': /* timing log */
+        opts->log_path = optarg;
+        break;
+      case 'm': /* multi-point calibration */
+        opts->cal_points = atoi(optarg);
+        break;
+      case 's': /* smallest loop count for multi-point calibration */
+        opts->cal_min = strtoull(optarg,NULL,10);
+        break;
       case 'n': /* number of tests */
         n_flag = 1;
         opts->num_tests = atoi(optarg);
@@ -78,6 +116,9 @@ int process_args( int argc, char **argv, optargs_t *opts) {
       case 'v': /* verbose */
         opts->verbose = 1;
         break;
+      case 'w': /* log writer cpu */
+        opts->log_cpu = atoi(optarg);
+        break;
       case '?':
         fprintf(stderr, "Unkown option -%c\n", optopt);
         usage(argv);
@@ -113,6 +154,11 @@ int process_args( int argc, char **argv, optargs_t *opts) {
     usage(argv);
   }
 
+  if (opts->buf_bytes < 64) {
+    fprintf(stderr, "\n-B must be at least 64 (one cache line)\n");
+    usage(argv);
+  }
+
   return 0;
 }
 
@@ -123,6 +169,15 @@ void set_default_options( optargs_t *options ) {
   options->num_tests = 0;
   options->target_nsec = 0;
   options->verbose = 0;
+  options->cal_points = 0;
+  options->cal_min = 0;
+  options->numa_placement = NUMA_LOCAL;
+  options->buf_bytes = WORK_BUF_DEFAULT_BYTES;
+  options->work_cpu = 0;
+  options->gap_threshold = GAP_THRESHOLD_DEFAULT;
+  options->gap_policy = GAP_WALL;
+  options->log_path = NULL;
+  options->log_cpu = -1;
 } 
 
 /*
@@ -140,10 +195,43 @@ int main( int argc, char ** argv ) {
     return -1;
   }
 
+  /* gap detection applies to calibration as well as the tests */
+  gap_threshold = options.gap_threshold;
+  gap_policy = options.gap_policy;
+
   /* calibrate the work loop */
   #if defined( WORK_NULL ) || defined( WORK_MXM ) || defined( WORK_ASM_NOP ) || defined( WORK_ASM_MUL ) || defined( WORK_ASM_FADD ) || defined( WORK_ASM_FMUL )
     if (options.verbose) printf("Calibrating:\n");
-    calibrate(options.num_trials, options.cycles_per_trial, options.rest_mode, options.verbose, &c_results);
+    if (options.cal_points > 1) {
+      calibrate_regression(options.num_trials, options.cal_min ? options.cal_min : options.cycles_per_trial / 1024,
+                           options.cycles_per_trial, options.cal_points, options.rest_mode, options.verbose, &c_results);
+    } else {
+      calibrate(options.num_trials, options.cycles_per_trial, options.rest_mode, options.verbose, &c_results);
+    }
+  #elif defined( WORK_MEM )
+    /* calibrate with the buffer on every node, then place it as requested */
+    mw_topology_t topo;
+    mw_numa_t numa;
+    mw_numa_cal_t numa_cal;
+    int n, node, local;
+    if (mw_topology_read(&topo) != 0 || mw_numa_read(&numa) != 0) return -1;
+    if (options.work_cpu < 0 || options.work_cpu >= MW_MAX_CPUS || !topo.online[options.work_cpu]) {
+      fprintf(stderr, "%s:%d: ERROR -- cpu %d is not online.\n", __FILE__, __LINE__, options.work_cpu);
+      return -1;
+    }
+    local = numa.node_of_cpu[options.work_cpu];
+    if (options.verbose) printf("Calibrating:\n");
+    mw_numa_calibrate(&numa, options.work_cpu, options.buf_bytes, options.num_trials,
+                      options.cal_min ? options.cal_min : options.cycles_per_trial / 1024, options.cycles_per_trial,
+                      options.cal_points, options.rest_mode, options.verbose, &numa_cal);
+    node = mw_numa_pick_node(&numa, options.work_cpu, options.numa_placement);
+    if (!numa_cal.valid[node]) {
+      fprintf(stderr, "%s:%d: ERROR -- no calibration for node %d.\n", __FILE__, __LINE__, node);
+      return -1;
+    }
+    c_results = numa_cal.results[node];
+    uint64_t *numa_buf = mw_numa_alloc(&numa, options.buf_bytes, node);
+    if (numa_buf == NULL || set_work_buffer(numa_buf, options.buf_bytes) != 0) return -1;
   #else
     fprintf(stderr, "%s:%d: ERROR -- unkown work type.\n", __FILE__, __LINE__);
     return -1;
@@ -168,6 +256,28 @@ int main( int argc, char ** argv ) {
   fprintf(stdout,"# Min               : %lld\n", c_results.min);
   fprintf(stdout,"# Max               : %lld\n", c_results.max);
   fprintf(stdout,"# calibration cycles: %lld\n", c_results.calibration_cycles);
+  if (c_results.model == CAL_LINEAR) {
+    fprintf(stdout,"# model             : linear (%d points)\n", options.cal_points);
+    fprintf(stdout,"# slope (nsec/loop) : %f\n", c_results.slope);
+    fprintf(stdout,"# intercept (nsec)  : %f\n", c_results.intercept);
+  }
+  #if defined( WORK_MEM )
+    fprintf(stdout,"# work cpu          : %d (node %d)\n", options.work_cpu, local);
+    fprintf(stdout,"# buffer            : %lld bytes on node %d\n", options.buf_bytes, node);
+    for (n = 0; n < MW_MAX_NODES; n++) {
+      if (!numa_cal.valid[n]) continue;
+      if (numa_cal.valid[local] && numa_cal.results[local].average > 0.0) {
+        fprintf(stdout,"# node %2d average   : %f (%.3fx local)\n", n, numa_cal.results[n].average,
+                numa_cal.results[n].average / numa_cal.results[local].average);
+      } else {
+        fprintf(stdout,"# node %2d average   : %f\n", n, numa_cal.results[n].average);
+      }
+    }
+  #endif
+  #if defined( WORK_GAP_DETECT )
+    fprintf(stdout,"# gap threshold     : %lld\n", gap_threshold);
+    fprintf(stdout,"# gap policy        : %s\n", gap_policy == GAP_CPU ? "cpu work" : "wall time");
+  #endif
   fprintf(stdout,"# target            : %lld\n", c_results.target_nsec);
   fprintf(stdout,"# loop_num          : %lld\n", c_results.loop_num);
   fprintf(stdout,"#############################################\n");
@@ -182,10 +292,33 @@ int main( int argc, char ** argv ) {
     host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
   #endif
   uint64_t *results = malloc(options.num_tests * sizeof(*results));
+  gap_stats_t *gaps = calloc(options.num_tests, sizeof(*gaps));
+
+  /* optional timing log; records are pushed in the loop and written by a background thread */
+  mw_log_t *log = NULL;
+  mw_ring_t *ring = NULL;
+  mw_record_t rec;
+  uint32_t tsc_aux;
+  if (options.log_path != NULL) {
+    log = mw_log_open(options.log_path, options.log_cpu);
+    if (log != NULL) {
+      ring = mw_log_ring(log, options.num_tests < LOG_RING_MAX ? options.num_tests : LOG_RING_MAX);
+    }
+    if (ring == NULL) {
+      fprintf(stderr, "%s:%d: ERROR -- could not set up timing log.\n", __FILE__, __LINE__);
+      return -1;
+    }
+    rec.req_cycles = loop_num;
+    rec.target_nsec = options.target_nsec;
+    rec.kernel = WORK_KERNEL;
+  }
 
-  fprintf(stdout,"%lld\t", options.target_nsec);
   for (t=0;t<options.num_tests;t++) {
     
+    /* the log's TSC reads bracket the clock reads, so they add nothing 
+       to the measured duration */
+    if (ring != NULL) TSC_START_C(rec.start_tsc)
+
     /* get start of trial timestamp */
     #if defined(__MACH__)
       clock_get_time(cclock, &mts_start);
@@ -208,6 +341,8 @@ int main( int argc, char ** argv ) {
       WORK_ASM_FADD_C
     #elif defined( WORK_ASM_FMUL )
       WORK_ASM_FMUL_C
+    #elif defined( WORK_MEM )
+      WORK_MEM_C
     #else
       fprintf(stderr, "%s:%d: ERROR -- unkown work type.\n", __FILE__, __LINE__);
       #if defined(__MACH__)
@@ -215,7 +350,7 @@ int main( int argc, char ** argv ) {
       #endif
       return -1;
     #endif
-    
+
     /* get end of trial timestamp */
     #if defined(__MACH__)
       clock_get_time(cclock, &mts_end);
@@ -229,10 +364,17 @@ int main( int argc, char ** argv ) {
         return(-1);
       }
     #endif
+
+    if (ring != NULL) TSC_END_C(rec.end_tsc, tsc_aux)
     
     results[t] = timespec_sub(&start, &end);
-    fprintf(stdout,"%lld\t", results[t]);
-    fflush(stdout);
+    gaps[t] = gap_stats;
+
+    /* no I/O in the measured sequence: results are printed after the loop */
+    if (ring != NULL) {
+      rec.cpu = TSC_AUX_CPU(tsc_aux);
+      mw_ring_push(ring, &rec);
+    }
     
     /* rest */
     switch (options.rest_mode) {
@@ -248,6 +390,15 @@ int main( int argc, char ** argv ) {
     }
   }
  
+  if (log != NULL && mw_log_close(log) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: timing log %s may be incomplete\n", __FILE__, __LINE__, options.log_path);
+  }
+
+  fprintf(stdout,"%lld\t", options.target_nsec);
+  for (t=0;t<options.num_tests;t++) {
+    fprintf(stdout,"%lld\t", results[t]);
+  }
+
   /* get average ratio */
   uint64_t sum = 0.;
   for (t=0;t<options.num_trials;t++) {
@@ -257,12 +408,28 @@ int main( int argc, char ** argv ) {
   double avg_ratio = avg_err/(double)options.target_nsec;
 
   fprintf(stdout,"%f\n", avg_ratio);
+
+  /* per-test preemption gaps: count, total cycles, longest */
+  #if defined( WORK_GAP_DETECT )
+    fprintf(stdout,"# gap_count  ");
+    for (t=0;t<options.num_tests;t++) fprintf(stdout,"\t%lld", gaps[t].count);
+    fprintf(stdout,"\n# gap_cycles ");
+    for (t=0;t<options.num_tests;t++) fprintf(stdout,"\t%lld", gaps[t].cycles);
+    fprintf(stdout,"\n# gap_max    ");
+    for (t=0;t<options.num_tests;t++) fprintf(stdout,"\t%lld", gaps[t].max);
+    fprintf(stdout,"\n");
+  #endif
    
   #if defined(__MACH__)
     mach_port_deallocate(mach_task_self(), cclock);
   #endif
 
   free(results);
+  free(gaps);
+  #if defined( WORK_MEM )
+    set_work_buffer(NULL, 0);
+    mw_numa_free(numa_buf, options.buf_bytes);
+  #endif
 
   return 0;
 }
@@ -22,6 +22,8 @@
 #endif
 
 #include "microwork_inline.h"
+#include "microwork_log.h"
+#include "microwork_numa.h"
 
 /* runtime options */
 typedef struct optargs_s {
@@ -31,8 +33,21 @@ typedef struct optargs_s {
   int num_tests;              /* number of tests */ 
   uint64_t target_nsec;       /* desired duration of work */
   int verbose;                /* verbose */
+  int cal_points;             /* > 1: multi-point regression calibration */
+  uint64_t cal_min;           /* smallest loop count for multi-point calibration */
+  int numa_placement;         /* WORK_MEM: 0 = buffer on the local node, 1 = remote */
+  uint64_t buf_bytes;         /* WORK_MEM: size of the work buffer */
+  int work_cpu;               /* WORK_MEM: cpu to run on */
+  uint64_t gap_threshold;     /* WORK_GAP_DETECT: gap threshold in cycles */
+  int gap_policy;             /* WORK_GAP_DETECT: 0 = wall time, 1 = cpu work */
+  char *log_path;             /* binary timing log, or NULL */
+  int log_cpu;                /* cpu for the log writer thread, or -1 */
 } optargs_t;
 
+/* largest ring used for the timing log; tests beyond this may be dropped 
+   if the writer cannot keep up */
+#define LOG_RING_MAX (1 << 20)
+
 /* set default runtime options */
 void set_default_options( optargs_t *options );
 
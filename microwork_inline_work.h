@@ -24,6 +24,7 @@
  * WORK_ASM_MUL_C
  * WORK ASM_FADD_C
  * WORK_ASM_FMUL_C
+ * WORK_MEM_C
  *
  * To use, the variable loop_num should be defined and set 
  * before the location the fragment is inserted. This variable 
@@ -36,6 +37,132 @@
 #if !defined( __MICROWORK_WORK_H_ )
 #define __MICROWORK_WORK_H_
 
+#include <stdint.h>
+
+/* kernel identifiers, e.g. for tagging timing records */
+typedef enum work_kernel_e {
+  KERNEL_NULL,
+  KERNEL_MXM,
+  KERNEL_ASM_NOP,
+  KERNEL_ASM_MUL,
+  KERNEL_ASM_FADD,
+  KERNEL_ASM_FMUL,
+  KERNEL_MEM,
+  KERNEL_COUNT
+} work_kernel_t;
+
+/* printable names, indexed by work_kernel_t */
+#define WORK_KERNEL_NAMES { "null", "mxm", "asm_nop", "asm_mul", "asm_fadd", "asm_fmul", "mem" }
+
+/*******************************************************************
+ * Time stamp counter reads.
+ *
+ * TSC_START_C(t)    : CPUID (serialize), then RDTSC into t
+ * TSC_END_C(t, aux) : RDTSCP into t, then CPUID so later code 
+ *                     cannot start early. aux receives IA32_TSC_AUX, 
+ *                     which Linux sets to (node << 12) | cpu.
+ *
+ * t must be a uint64_t lvalue, aux a uint32_t lvalue.
+ *******************************************************************/
+#define TSC_START_C(_t)                                                                   \
+  {                                                                                       \
+    uint64_t _tsh, _tsl;                                                                  \
+    __asm__ __volatile__ (  "CPUID        ;"                                              \
+                            "RDTSC        ;"                                              \
+                            "mov %%rdx, %0;"                                              \
+                            "mov %%rax, %1;"                                              \
+                            : "=r" (_tsh), "=r" (_tsl) : : "%rax", "%rbx", "%rcx", "%rdx"); \
+    (_t) = ( (_tsh << 32) | _tsl );                                                       \
+  }
+
+#define TSC_END_C(_t, _aux)                                                               \
+  {                                                                                       \
+    uint64_t _teh, _tel;                                                                  \
+    uint32_t _tea;                                                                        \
+    __asm__ __volatile__ (  "RDTSCP       ;"                                              \
+                            "mov %%rdx, %0;"                                              \
+                            "mov %%rax, %1;"                                              \
+                            "mov %%ecx, %2;"                                              \
+                            "CPUID        ;"                                              \
+                            : "=r" (_teh), "=r" (_tel), "=r" (_tea) : : "%rax", "%rbx", "%rcx", "%rdx"); \
+    (_t) = ( (_teh << 32) | _tel );                                                       \
+    (_aux) = _tea;                                                                        \
+  }
+
+/* cpu number from the aux value returned by TSC_END_C (Linux convention) */
+#define TSC_AUX_CPU(_aux) ((_aux) & 0xfff)
+
+/* TSC ticks per nanosecond, measured against CLOCK_MONOTONIC over 
+   ~50 ms (microwork_common.c) */
+double mw_measure_tsc_rate();
+
+/* qsort comparator for uint64_t (microwork_common.c) */
+int mw_cmp_u64(const void *a, const void *b);
+
+/*******************************************************************
+ * Preemption gap detection for the ASM loops (WORK_GAP_DETECT).
+ *
+ * If the thread is descheduled inside an ASM loop, consecutive TSC 
+ * reads are far apart. When compiled with WORK_GAP_DETECT, any step 
+ * longer than gap_threshold cycles is counted in gap_stats, and with 
+ * GAP_CPU the deadline is pushed back by the step's excess over the 
+ * last normal step, so the loop delivers the requested cycles of its 
+ * own execution rather than of wall time.
+ *
+ * The settings and statistics below are defined in microwork_common.c, 
+ * which programs using the ASM loops link. gap_stats is reset on entry 
+ * to the loop.
+ *******************************************************************/
+typedef enum gap_policy_e {
+  GAP_WALL,   /* stop at the deadline; gaps are only counted */
+  GAP_CPU     /* extend the deadline by each gap */
+} gap_policy_t;
+
+typedef struct gap_stats_s {
+  uint64_t count;   /* number of gaps */
+  uint64_t cycles;  /* sum of gap lengths */
+  uint64_t max;     /* longest gap */
+} gap_stats_t;
+
+/* default gap threshold, in cycles */
+#define GAP_THRESHOLD_DEFAULT 20000
+
+/* gap detection settings, and the gaps seen by this thread's most 
+   recent ASM work loop */
+extern uint64_t gap_threshold;
+extern gap_policy_t gap_policy;
+extern __thread gap_stats_t gap_stats;
+
+/* WORK_ASM_STEP: statement the ASM loops run once per iteration, e.g. 
+   to count iterations; empty unless defined before this header */
+#if !defined( WORK_ASM_STEP )
+  #define WORK_ASM_STEP
+#endif
+
+#if defined( WORK_GAP_DETECT )
+/* _pc: previous TSC read; _ns: length of the last step without a gap */
+#define _WORK_GAP_INIT                                    \
+  uint64_t _pc = _sc, _ns = 0;                            \
+  gap_stats.count = 0;                                    \
+  gap_stats.cycles = 0;                                   \
+  gap_stats.max = 0;
+/* GAP_CPU adds back only the step's excess over a normal step, 
+   since the step also includes the iteration's own cycles */
+#define _WORK_GAP_CHECK                                   \
+    if (_cc - _pc > gap_threshold) {                      \
+      gap_stats.count++;                                  \
+      gap_stats.cycles += _cc - _pc;                      \
+      if (_cc - _pc > gap_stats.max) gap_stats.max = _cc - _pc; \
+      if (gap_policy == GAP_CPU) _tc += _cc - _pc - _ns;  \
+    } else {                                              \
+      _ns = _cc - _pc;                                    \
+    }                                                     \
+    _pc = _cc;
+#else
+#define _WORK_GAP_INIT
+#define _WORK_GAP_CHECK
+#endif
+
 /*******************************************************************
  * No work at all.
  *******************************************************************/
@@ -82,6 +209,7 @@
                           : "=r" (_sh), "=r" (_sl) : : "%rax", "%rbx", "%rcx", "%rdx");   \
   _sc = ( ((uint64_t)_sh << 32) | _sl );                                                  \
   _tc = _sc + loop_num;                                                                   \
+  _WORK_GAP_INIT                                                                          \
   do {                                                                                    \
     __asm__ __volatile__ (  "nop          ;"                                              \
                             "CPUID        ;"                                              \
@@ -91,6 +219,8 @@
                             "CPUID        ;"                                              \
                             : "=r" (_ch), "=r" (_cl) : : "%rax", "%rbx", "%rcx", "%rdx"); \
     _cc = ( ((uint64_t)_ch << 32) | _cl );                                                \
+    _WORK_GAP_CHECK                                                                       \
+    WORK_ASM_STEP                                                                         \
   } while (_cc <= _tc);
 /* END ASM NOP WORK LOOP */
 
@@ -108,6 +238,7 @@
                           : "=r" (_sh), "=r" (_sl) : : "%rax", "%rbx", "%rcx", "%rdx");   \
   _sc = ( ((uint64_t)_sh << 32) | _sl );                                                  \
   _tc = _sc + loop_num;                                                                   \
+  _WORK_GAP_INIT                                                                          \
   do {                                                                                    \
     __asm__ __volatile__ ("movl %2, %%eax       ;"                                        \
                           "movl %3, %%ebx       ;"                                        \
@@ -118,6 +249,8 @@
                           "mov %%rax, %1        ;"                                        \
                           : "=r" (_ch), "=r" (_cl) : "g" (_aint), "g" (_bint) : "%eax", "%ebx", "%rax", "%rbx" );\
     _cc = ( ((uint64_t)_ch << 32) | _cl );                                                \
+    _WORK_GAP_CHECK                                                                       \
+    WORK_ASM_STEP                                                                         \
   } while (_cc <= _tc);
 /* END ASM MUL WORK LOOP */
 
@@ -135,6 +268,7 @@
                           : "=r" (_sh), "=r" (_sl) : : "%rax", "%rbx", "%rcx", "%rdx");     \
   _sc = ( ((uint64_t)_sh << 32) | _sl );                                                    \
   _tc = _sc + loop_num;                                                                     \
+  _WORK_GAP_INIT                                                                            \
   do {                                                                                      \
     __asm__ __volatile__ ("flds %3;"                                          \
                           "faddp;"                                          \
@@ -144,6 +278,8 @@
                           "mov %%rax, %2;"                                          \
                           : "=&t" (_o), "=r" (_ch), "=r" (_cl) : "m" (_bf), "0" (5.35667) : "st(1)", "%eax", "%ebx", "%rax", "%rdx" );\
     _cc = ( ((uint64_t)_ch << 32) | _cl );                                                  \
+    _WORK_GAP_CHECK                                                                         \
+    WORK_ASM_STEP                                                                           \
   } while (_cc <= _tc);
 /* END ASM FLOAT ADD LOOP */
 
@@ -173,6 +309,7 @@
                           : "=r" (_sh), "=r" (_sl) : : "%rax", "%rbx", "%rcx", "%rdx");     \
   _sc = ( ((uint64_t)_sh << 32) | _sl );                                                    \
   _tc = _sc + loop_num;                                                                     \
+  _WORK_GAP_INIT                                                                            \
   do {                                                                                      \
     __asm__ __volatile__ ("flds %3;"                                          \
                           "fmulp;"                                          \
@@ -182,8 +319,27 @@
                           "mov %%rax, %2;"                                          \
                           : "=&t" (_o), "=r" (_ch), "=r" (_cl) : "m" (_bf), "0" (5.35667) : "st(1)", "%eax", "%ebx", "%rax", "%rdx" );\
     _cc = ( ((uint64_t)_ch << 32) | _cl );                                                  \
+    _WORK_GAP_CHECK                                                                         \
+    WORK_ASM_STEP                                                                           \
   } while (_cc <= _tc);
 /* END ASM FLOATING POINT MUL C */
 
+/*******************************************************************
+ * Memory work loop (WORK_MEM)
+ *
+ * Read-modify-write of loop_num cache lines of a buffer, wrapping 
+ * around. Requires uint64_t *work_buf and uint64_t work_buf_lines 
+ * (number of 64 byte lines in work_buf) to be in scope. Its duration 
+ * depends on where work_buf lives, e.g., which NUMA node.
+ *******************************************************************/
+#define _WORK_LINE_WORDS (8)
+#define WORK_MEM_C                                                                        \
+  uint64_t _ml, _mi = 0;                                                                  \
+  for (_ml = 0; _ml < loop_num; ++_ml) {                                                  \
+    work_buf[_mi * _WORK_LINE_WORDS] += _ml;                                              \
+    if (++_mi == work_buf_lines) _mi = 0;                                                 \
+  }
+/* END MEM WORK LOOP */
+
 #endif /* __MICROWORK_WORK_H_ */
 
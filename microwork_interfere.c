@@ -0,0 +1,334 @@
+/*****************************************************************************
+ *
+ * microwork_interfere.c
+ *
+ * Antagonist threads for co-runner interference experiments and the
+ * sysfs topology used to place them. See microwork_interfere.h.
+ *
+ *****************************************************************************/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "microwork_interfere.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+/* bytes per cache line assumed by the LLC walk */
+#define LINE_BYTES 64
+
+/* the bandwidth antagonist streams over this multiple of the LLC */
+#define BANDWIDTH_LLC_MULTIPLE 4
+
+/* iterations of the SMT antagonist's chains between checks for stop */
+#define SMT_ITERS (1 << 20)
+
+/*******************************************************************
+ * TOPOLOGY
+ *******************************************************************/
+
+int mw_read_line(const char *path, char *buf, int len) {
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) return -1;
+  if (fgets(buf, len, fp) == NULL) {
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  buf[strcspn(buf, "\n")] = '\0';
+  return 0;
+}
+
+/* read an integer from a sysfs file, or return def */
+static int read_int(const char *path, int def) {
+  char buf[64];
+  return mw_read_line(path, buf, sizeof(buf)) == 0 ? atoi(buf) : def;
+}
+
+int mw_parse_cpulist(const char *list, int *set) {
+  const char *p = list;
+  char *end;
+  long lo, hi, c;
+  int n = 0;
+
+  memset(set, 0, MW_MAX_CPUS * sizeof(*set));
+  while (*p) {
+    lo = strtol(p, &end, 10);
+    if (end == p) break;
+    hi = lo;
+    p = end;
+    if (*p == '-') {
+      hi = strtol(p + 1, &end, 10);
+      p = end;
+    }
+    for (c = lo; c <= hi && c < MW_MAX_CPUS; c++) {
+      if (c >= 0 && !set[c]) {
+        set[c] = 1;
+        n++;
+      }
+    }
+    if (*p == ',') p++;
+    else break;
+  }
+  return n;
+}
+
+/* parse a cache size such as "32768K" */
+static uint64_t parse_size(const char *s) {
+  char *end;
+  uint64_t v = strtoull(s, &end, 10);
+  if (*end == 'K') v *= 1024;
+  else if (*end == 'M') v *= 1024 * 1024;
+  else if (*end == 'G') v *= 1024 * 1024 * 1024;
+  return v;
+}
+
+int mw_topology_read(mw_topology_t *topo) {
+  char path[256], buf[4096];
+  int c, i, level, max_level = 0;
+
+  memset(topo, 0, sizeof(*topo));
+
+  if (mw_read_line(SYSFS_CPU "/online", buf, sizeof(buf)) == 0) {
+    mw_parse_cpulist(buf, topo->online);
+  } else {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    for (c = 0; c < n && c < MW_MAX_CPUS; c++) topo->online[c] = 1;
+  }
+
+  for (c = 0; c < MW_MAX_CPUS; c++) {
+    if (!topo->online[c]) continue;
+    topo->num_cpus = c + 1;
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", c);
+    topo->package[c] = read_int(path, 0);
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", c);
+    topo->core[c] = read_int(path, c);
+  }
+  if (topo->num_cpus == 0) {
+    fprintf(stderr, "%s:%d: ERROR -- no online cpus found.\n", __FILE__, __LINE__);
+    return -1;
+  }
+
+  /* the LLC is the highest level unified or data cache of the first online cpu */
+  for (c = 0; c < topo->num_cpus && !topo->online[c]; c++);
+  for (i = 0; i < 16; i++) {
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/type", c, i);
+    if (mw_read_line(path, buf, sizeof(buf)) != 0) break;
+    if (strcmp(buf, "Instruction") == 0) continue;
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", c, i);
+    level = read_int(path, 0);
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/size", c, i);
+    if (level > max_level && mw_read_line(path, buf, sizeof(buf)) == 0) {
+      max_level = level;
+      topo->llc_bytes = parse_size(buf);
+    }
+  }
+  if (topo->llc_bytes == 0) topo->llc_bytes = MW_DEFAULT_LLC_BYTES;
+
+  return 0;
+}
+
+int mw_antagonist_cpus(const mw_topology_t *topo, antagonist_t type, int work_cpu, int num_threads, int *cpus) {
+  int c, n = 0, sibling;
+
+  if (work_cpu < 0 || work_cpu >= topo->num_cpus) work_cpu = 0;
+
+  for (c = 0; c < topo->num_cpus && n < num_threads; c++) {
+    if (!topo->online[c] || c == work_cpu) continue;
+    if (topo->package[c] != topo->package[work_cpu]) continue;
+    sibling = topo->core[c] == topo->core[work_cpu];
+    /* SMT antagonists want the work cpu's siblings; the others want other cores */
+    if ((type == ANTAGONIST_SMT) == sibling) cpus[n++] = c;
+  }
+  return n;
+}
+
+int mw_pin_self(int cpu) {
+  #if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? 0 : -1;
+  #else
+    return -1;
+  #endif
+}
+
+/*******************************************************************
+ * ANTAGONISTS
+ *******************************************************************/
+
+static int stopped(mw_interfere_t *mi) {
+  return __atomic_load_n(&mi->stop, __ATOMIC_RELAXED);
+}
+
+static void set_ready(mw_interfere_t *mi) {
+  __atomic_fetch_add(&mi->ready, 1, __ATOMIC_RELEASE);
+}
+
+/* STREAM triad over three arrays much larger than the LLC */
+static void run_bandwidth(mw_antagonist_t *ant) {
+  mw_interfere_t *mi = ant->mi;
+  uint64_t i, n = mi->buffer_bytes / (3 * sizeof(double));
+  double *a = (double *)malloc(n * sizeof(double));
+  double *b = (double *)malloc(n * sizeof(double));
+  double *c = (double *)malloc(n * sizeof(double));
+  double scalar = 3.0;
+
+  if (a == NULL || b == NULL || c == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating bandwidth antagonist.\n", __FILE__, __LINE__);
+    set_ready(mi);
+    free(a); free(b); free(c);
+    return;
+  }
+  /* first touch from the antagonist's own cpu */
+  for (i = 0; i < n; i++) {
+    a[i] = 0.0;
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
+  set_ready(mi);
+
+  while (!stopped(mi)) {
+    for (i = 0; i < n; i++) a[i] = b[i] + scalar * c[i];
+    ant->passes++;
+  }
+  free(a); free(b); free(c);
+}
+
+/* random walk over the cache lines of a buffer larger than the LLC,
+   dirtying each line it visits */
+static void run_llc(mw_antagonist_t *ant) {
+  mw_interfere_t *mi = ant->mi;
+  uint64_t i, j, tmp, p, n = mi->buffer_bytes / LINE_BYTES;
+  uint64_t stride = LINE_BYTES / sizeof(uint64_t);
+  uint64_t *buf = (uint64_t *)malloc(n * LINE_BYTES);
+  unsigned int seed = (unsigned int)ant->cpu + 1;
+
+  if (buf == NULL || n < 2) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating LLC antagonist.\n", __FILE__, __LINE__);
+    set_ready(mi);
+    free(buf);
+    return;
+  }
+
+  /* a single cycle through all lines (Sattolo's algorithm) defeats the prefetchers */
+  for (i = 0; i < n; i++) buf[i * stride] = i;
+  for (i = n - 1; i > 0; i--) {
+    j = (uint64_t)rand_r(&seed) % i;
+    tmp = buf[i * stride];
+    buf[i * stride] = buf[j * stride];
+    buf[j * stride] = tmp;
+  }
+  set_ready(mi);
+
+  p = 0;
+  while (!stopped(mi)) {
+    for (i = 0; i < n; i++) {
+      buf[p * stride + 1]++;
+      p = buf[p * stride];
+    }
+    ant->passes++;
+  }
+  free(buf);
+}
+
+/* independent multiply/add chains to keep the sibling's integer ports busy */
+static void run_smt(mw_antagonist_t *ant) {
+  mw_interfere_t *mi = ant->mi;
+  uint64_t i, a = 1, b = 2, c = 3, d = 4;
+  volatile uint64_t sink;
+
+  set_ready(mi);
+  while (!stopped(mi)) {
+    for (i = 0; i < SMT_ITERS; i++) {
+      a = a * 6364136223846793005ULL + 1442695040888963407ULL;
+      b = b * 2862933555777941757ULL + 3037000493ULL;
+      c = c * 3202034522624059733ULL + 1ULL;
+      d = d * 3935559000370003845ULL + 2691343689449507681ULL;
+    }
+    ant->passes++;
+  }
+  sink = a + b + c + d;
+  (void)sink;
+}
+
+static void *antagonist_main(void *arg) {
+  mw_antagonist_t *ant = (mw_antagonist_t *)arg;
+
+  if (mw_pin_self(ant->cpu) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: could not pin antagonist to cpu %d\n", __FILE__, __LINE__, ant->cpu);
+  }
+  switch (ant->mi->type) {
+    case ANTAGONIST_BANDWIDTH:
+      run_bandwidth(ant);
+      break;
+    case ANTAGONIST_LLC:
+      run_llc(ant);
+      break;
+    case ANTAGONIST_SMT:
+      run_smt(ant);
+      break;
+    default:
+      set_ready(ant->mi);
+  }
+  return NULL;
+}
+
+int mw_interfere_start(mw_interfere_t *mi, antagonist_t type, int num_threads, int work_cpu, const mw_topology_t *topo) {
+  static const char *names[] = ANTAGONIST_NAMES;
+  int cpus[MW_MAX_ANTAGONISTS];
+  int i, found;
+  struct timespec wait = { 0, 1000000 };
+
+  memset(mi, 0, sizeof(*mi));
+  mi->type = type;
+  if (type == ANTAGONIST_NONE || num_threads < 1) return 0;
+  if (num_threads > MW_MAX_ANTAGONISTS) num_threads = MW_MAX_ANTAGONISTS;
+
+  found = mw_antagonist_cpus(topo, type, work_cpu, num_threads, cpus);
+  if (found == 0 && type == ANTAGONIST_SMT) {
+    /* no SMT sibling: the next best thing is another core of the package */
+    fprintf(stderr, "%s:%d: WARNING: cpu %d has no SMT sibling; running smt antagonist on other cores\n", __FILE__, __LINE__, work_cpu);
+    found = mw_antagonist_cpus(topo, ANTAGONIST_LLC, work_cpu, num_threads, cpus);
+  }
+  if (found == 0) {
+    fprintf(stderr, "%s:%d: WARNING: no spare cpus; %s antagonists will time-share cpu %d\n", __FILE__, __LINE__, names[type], work_cpu);
+    cpus[0] = work_cpu;
+    found = 1;
+  } else if (found < num_threads) {
+    fprintf(stderr, "%s:%d: WARNING: %d %s antagonists share %d cpus\n", __FILE__, __LINE__, num_threads, names[type], found);
+  }
+
+  mi->buffer_bytes = type == ANTAGONIST_BANDWIDTH ? BANDWIDTH_LLC_MULTIPLE * topo->llc_bytes : topo->llc_bytes + topo->llc_bytes / 2;
+  for (i = 0; i < num_threads; i++) {
+    mi->ant[i].mi = mi;
+    mi->ant[i].cpu = cpus[i % found];
+    if (pthread_create(&mi->ant[i].thread, NULL, antagonist_main, &mi->ant[i]) != 0) {
+      fprintf(stderr, "%s:%d: ERROR -- could not start antagonist thread.\n", __FILE__, __LINE__);
+      mw_interfere_stop(mi);
+      return -1;
+    }
+    mi->num_threads++;
+  }
+
+  /* do not return until every antagonist is generating load */
+  while (__atomic_load_n(&mi->ready, __ATOMIC_ACQUIRE) < mi->num_threads) nanosleep(&wait, NULL);
+  return 0;
+}
+
+void mw_interfere_stop(mw_interfere_t *mi) {
+  int i;
+
+  __atomic_store_n(&mi->stop, 1, __ATOMIC_RELAXED);
+  for (i = 0; i < mi->num_threads; i++) pthread_join(mi->ant[i].thread, NULL);
+  mi->num_threads = 0;
+}
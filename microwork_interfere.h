@@ -0,0 +1,117 @@
+/*****************************************************************************
+ *
+ * microwork_interfere.h
+ *
+ * Co-runner interference: antagonist threads that run alongside a
+ * measured work thread, placed using the cpu topology from sysfs.
+ *
+ *   ANTAGONIST_BANDWIDTH : STREAM-like triad over arrays much larger than
+ *                          the LLC, on other cores of the work cpu's package
+ *   ANTAGONIST_LLC       : random cache-line walk over a buffer somewhat
+ *                          larger than the LLC, on other cores of the package
+ *   ANTAGONIST_SMT       : integer multiply/add chains on the SMT sibling(s)
+ *                          of the work cpu
+ *
+ *****************************************************************************/
+
+#if !defined( __MICROWORK_INTERFERE_H_ )
+#define __MICROWORK_INTERFERE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* largest cpu number handled */
+#define MW_MAX_CPUS 1024
+
+/* most antagonist threads per generator */
+#define MW_MAX_ANTAGONISTS 64
+
+/* LLC size assumed if sysfs does not say */
+#define MW_DEFAULT_LLC_BYTES (8 * 1024 * 1024)
+
+/* antagonist types */
+typedef enum antagonist_e {
+  ANTAGONIST_NONE,
+  ANTAGONIST_BANDWIDTH,
+  ANTAGONIST_LLC,
+  ANTAGONIST_SMT,
+  ANTAGONIST_COUNT
+} antagonist_t;
+
+/* printable names, indexed by antagonist_t */
+#define ANTAGONIST_NAMES { "none", "bandwidth", "llc", "smt" }
+
+/* cpu topology, from /sys/devices/system/cpu */
+typedef struct mw_topology_s {
+  int num_cpus;                 /* highest online cpu + 1 */
+  int online[MW_MAX_CPUS];
+  int package[MW_MAX_CPUS];     /* physical_package_id */
+  int core[MW_MAX_CPUS];        /* core_id */
+  uint64_t llc_bytes;           /* size of the last level cache */
+} mw_topology_t;
+
+/* one antagonist thread */
+typedef struct mw_antagonist_s {
+  pthread_t thread;
+  int cpu;
+  uint64_t passes;              /* completed passes over its buffer or loop */
+  struct mw_interfere_s *mi;
+} mw_antagonist_t;
+
+/* running antagonists */
+typedef struct mw_interfere_s {
+  antagonist_t type;
+  int num_threads;
+  int stop;
+  int ready;                    /* threads that have set up and started */
+  uint64_t buffer_bytes;        /* per-thread buffer size (BANDWIDTH, LLC) */
+  mw_antagonist_t ant[MW_MAX_ANTAGONISTS];
+} mw_interfere_t;
+
+/* Read the cpu topology. Missing sysfs entries degrade to one package
+ * with one thread per core.
+ *
+ * Returns: 0 on success, -1 if no cpus could be found.
+ */
+int mw_topology_read(mw_topology_t *topo);
+
+/* Read the first line of a (sysfs) file into buf, without the newline.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int mw_read_line(const char *path, char *buf, int len);
+
+/* Parse a sysfs cpu list such as "0-3,8,10-11".
+ *
+ * set : array of MW_MAX_CPUS flags, set to 1 for each listed cpu
+ *
+ * Returns: number of cpus listed.
+ */
+int mw_parse_cpulist(const char *list, int *set);
+
+/* Choose cpus for antagonists of a type relative to the work cpu.
+ *
+ * cpus        : returned cpu numbers
+ * num_threads : number wanted
+ *
+ * Returns: number of distinct cpus found; if fewer than num_threads,
+ * the caller's antagonists will share cpus (and possibly the work cpu).
+ */
+int mw_antagonist_cpus(const mw_topology_t *topo, antagonist_t type, int work_cpu, int num_threads, int *cpus);
+
+/* Start antagonist threads. ANTAGONIST_NONE starts nothing.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int mw_interfere_start(mw_interfere_t *mi, antagonist_t type, int num_threads, int work_cpu, const mw_topology_t *topo);
+
+/* Stop and join antagonist threads. */
+void mw_interfere_stop(mw_interfere_t *mi);
+
+/* Pin the calling thread to a cpu.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int mw_pin_self(int cpu);
+
+#endif /* __MICROWORK_INTERFERE_H_ */
@@ -0,0 +1,204 @@
+/*****************************************************************************
+ *
+ * microwork_interfere_test.c
+ *
+ * Measures how the accuracy and fixed overhead of the configured work
+ * loop degrade when antagonists share the node. The loop is calibrated
+ * on the otherwise idle machine, then tested with no antagonist and
+ * with each antagonist type in turn.
+ *
+ * For each antagonist a row is printed with:
+ *   - error of the requested duration (mean, mean relative, p50/p99 of |error|)
+ *   - overhead: median duration of a zero-length request
+ *   - both relative to the no-antagonist row
+ *
+ * Build one binary per work type (mwi_*.x) and compare the rows to
+ * pick the loop that holds up best.
+ *
+ *****************************************************************************/
+
+#include "microwork_inline.h"
+#include "microwork_interfere.h"
+
+/* runtime options */
+typedef struct mwi_opts_s {
+  uint64_t cycles_per_trial;
+  int num_trials;
+  int rest_mode;
+  int num_tests;
+  uint64_t target_nsec;
+  int num_antagonists;        /* threads per antagonist type */
+  int work_cpu;
+  int cal_points;             /* > 1: multi-point calibration */
+  int verbose;
+} mwi_opts_t;
+
+/* results under one antagonist */
+typedef struct mwi_row_s {
+  double mean_err;
+  double mean_rel_err;
+  uint64_t p50_abs_err;
+  uint64_t p99_abs_err;
+  uint64_t overhead;
+  uint64_t passes;
+} mwi_row_t;
+
+void usage(char **argv) {
+  printf("\n################################################################\n");
+  printf("Usage:\n");
+  printf("  %s -c <cycles> -t <trials> -d <nsecs> -n <tests> -r <rest_mode> [-a <threads>] [-p <cpu>] [-m <points>] -v\n", argv[0]);
+  printf("\nWhere:\n");
+  printf("  -c <cycles>  : number of cycles per calibration trial (required but ignored if work method is WORK_MXM)\n");
+  printf("  -d <nsecs>   : duration of each test (required)\n");
+  printf("  -n <tests>   : number of tests per antagonist (required)\n");
+  printf("  -t <trials>  : number of calibration trials (required)\n");
+  printf("  -r <int>     : rest mode for between calibration trials (required)\n");
+  printf("                  0 = sleep(1)\n");
+  printf("                  1 = write to /dev/null\n");
+  printf("  -a <threads> : antagonist threads of each type (optional; default 1)\n");
+  printf("  -p <cpu>     : cpu to run the work loop on (optional; default 0)\n");
+  printf("  -m <points>  : multi-point calibration (optional; see mit_*.x)\n");
+  printf("  -v           : verbose (optional)\n");
+  printf("################################################################");
+  printf("\n");
+  exit(-1);
+}
+
+int process_args(int argc, char **argv, mwi_opts_t *opts) {
+  int c;
+  extern char *optarg;
+  extern int optopt;
+  int c_flag = 0, d_flag = 0, n_flag = 0, r_flag = 0, t_flag = 0;
+
+  opts->cycles_per_trial = 0;
+  opts->num_trials = 0;
+  opts->rest_mode = 0;
+  opts->num_tests = 0;
+  opts->target_nsec = 0;
+  opts->num_antagonists = 1;
+  opts->work_cpu = 0;
+  opts->cal_points = 0;
+  opts->verbose = 0;
+
+  while ((c = getopt(argc, argv, "a:c:d:m:n:p:r:t:v")) != -1) {
+    switch(c)
+    {
+      case 'a': opts->num_antagonists = atoi(optarg); break;
+      case 'c': c_flag = 1; opts->cycles_per_trial = strtoull(optarg,NULL,10); break;
+      case 'd': d_flag = 1; opts->target_nsec = strtoull(optarg,NULL,10); break;
+      case 'm': opts->cal_points = atoi(optarg); break;
+      case 'n': n_flag = 1; opts->num_tests = atoi(optarg); break;
+      case 'p': opts->work_cpu = atoi(optarg); break;
+      case 'r': r_flag = 1; opts->rest_mode = atoi(optarg); break;
+      case 't': t_flag = 1; opts->num_trials = atoi(optarg); break;
+      case 'v': opts->verbose = 1; break;
+      case '?':
+        fprintf(stderr, "Unkown option -%c\n", optopt);
+        usage(argv);
+        break;
+      default:
+        usage(argv);
+        break;
+    }
+  }
+
+  if (!c_flag || !d_flag || !n_flag || !r_flag || !t_flag) {
+    fprintf(stderr, "\n-c, -d, -n, -r and -t options required\n");
+    usage(argv);
+  }
+  if (opts->num_tests < 1) usage(argv);
+  return 0;
+}
+
+/* run the tests for one antagonist */
+static void run_tests(const mwi_opts_t *opts, uint64_t loop_num, uint64_t *results, mwi_row_t *row) {
+  int t;
+  double sum_err = 0.0, sum_rel = 0.0;
+
+  for (t = 0; t < opts->num_tests; t++) results[t] = timed_work(loop_num);
+
+  for (t = 0; t < opts->num_tests; t++) {
+    double err = (double)results[t] - (double)opts->target_nsec;
+    sum_err += err;
+    if (opts->target_nsec) sum_rel += fabs(err) / opts->target_nsec;
+    results[t] = (uint64_t)fabs(err);
+  }
+  qsort(results, opts->num_tests, sizeof(*results), mw_cmp_u64);
+  row->mean_err = sum_err / opts->num_tests;
+  row->mean_rel_err = sum_rel / opts->num_tests;
+  row->p50_abs_err = results[opts->num_tests / 2];
+  row->p99_abs_err = results[(opts->num_tests * 99) / 100];
+
+  /* fixed overhead: the shortest possible request */
+  for (t = 0; t < opts->num_tests; t++) results[t] = timed_work(0);
+  qsort(results, opts->num_tests, sizeof(*results), mw_cmp_u64);
+  row->overhead = results[opts->num_tests / 2];
+}
+
+/*
+ * Mr. Main
+ */
+int main(int argc, char **argv) {
+  static const char *kernel_names[] = WORK_KERNEL_NAMES;
+  static const char *antagonist_names[] = ANTAGONIST_NAMES;
+  mwi_opts_t options;
+  mw_topology_t topo;
+  mw_interfere_t mi;
+  c_results_t c_results;
+  mwi_row_t rows[ANTAGONIST_COUNT];
+  uint64_t *results, loop_num;
+  int a, i;
+
+  process_args(argc, argv, &options);
+
+  if (mw_topology_read(&topo) != 0) return -1;
+  if (mw_pin_self(options.work_cpu) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: could not pin work loop to cpu %d\n", __FILE__, __LINE__, options.work_cpu);
+  }
+
+  /* calibrate on the idle machine */
+  if (options.verbose) printf("Calibrating:\n");
+  if (options.cal_points > 1) {
+    calibrate_regression(options.num_trials, options.cycles_per_trial / 1024, options.cycles_per_trial,
+                         options.cal_points, options.rest_mode, options.verbose, &c_results);
+  } else {
+    calibrate(options.num_trials, options.cycles_per_trial, options.rest_mode, options.verbose, &c_results);
+  }
+  loop_num = calc_loop_num(options.target_nsec, &c_results);
+
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# work loop         : %s\n", kernel_names[WORK_KERNEL]);
+  fprintf(stdout,"# calibration trials: %d\n", options.num_trials);
+  fprintf(stdout,"# num_tests         : %d\n", options.num_tests);
+  fprintf(stdout,"# target_nsec       : %lld\n", options.target_nsec);
+  fprintf(stdout,"# loop_num          : %lld\n", loop_num);
+  fprintf(stdout,"# work cpu          : %d\n", options.work_cpu);
+  fprintf(stdout,"# antagonist threads: %d\n", options.num_antagonists);
+  fprintf(stdout,"# llc bytes         : %lld\n", topo.llc_bytes);
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# antagonist # mean_err_nsec # mean_rel_err # p50_abs_err # p99_abs_err # overhead_nsec # rel_err_vs_none # overhead_vs_none # antagonist_passes #\n");
+
+  results = (uint64_t *)malloc(options.num_tests * sizeof(*results));
+
+  for (a = 0; a < ANTAGONIST_COUNT; a++) {
+    if (mw_interfere_start(&mi, (antagonist_t)a, options.num_antagonists, options.work_cpu, &topo) != 0) {
+      free(results);
+      return -1;
+    }
+    run_tests(&options, loop_num, results, &rows[a]);
+    mw_interfere_stop(&mi);
+
+    rows[a].passes = 0;
+    for (i = 0; i < options.num_antagonists && i < MW_MAX_ANTAGONISTS && a != ANTAGONIST_NONE; i++) rows[a].passes += mi.ant[i].passes;
+
+    fprintf(stdout, "%s\t%f\t%f\t%lld\t%lld\t%lld\t%f\t%f\t%lld\n", antagonist_names[a],
+        rows[a].mean_err, rows[a].mean_rel_err, rows[a].p50_abs_err, rows[a].p99_abs_err, rows[a].overhead,
+        rows[0].mean_rel_err > 0 ? rows[a].mean_rel_err / rows[0].mean_rel_err : 0.0,
+        rows[0].overhead > 0 ? rows[a].overhead / (double)rows[0].overhead : 0.0,
+        rows[a].passes);
+    fflush(stdout);
+  }
+
+  free(results);
+  return 0;
+}
@@ -0,0 +1,237 @@
+/*****************************************************************************
+ *
+ * microwork_log.c
+ *
+ * Background writer for per-thread timing record rings.
+ * See microwork_log.h for the file layout.
+ *
+ *****************************************************************************/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "microwork_inline_work.h"
+#include "microwork_log.h"
+
+/* current CLOCK_MONOTONIC time in nanoseconds */
+static uint64_t now_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* write out whatever is in the batch buffer */
+static void flush_batch(mw_log_t *log) {
+  size_t written;
+
+  if (log->batch_len == 0) return;
+  written = fwrite(log->batch, sizeof(mw_record_t), log->batch_len, log->fp);
+  if (written != log->batch_len) {
+    fprintf(stderr, "%s:%d: ERROR -- failure writing timing log.\n", __FILE__, __LINE__);
+    log->write_error = 1;
+  }
+  /* the header counts only records that are in the file */
+  log->num_records += written;
+  log->batch_len = 0;
+}
+
+/*
+ * Move everything currently queued in the rings into the batch buffer,
+ * writing the buffer out whenever it fills.
+ *
+ * Returns: number of records drained.
+ */
+static uint64_t drain_rings(mw_log_t *log) {
+  uint32_t i, num_rings;
+  uint64_t drained = 0;
+
+  num_rings = __atomic_load_n(&log->num_rings, __ATOMIC_ACQUIRE);
+  if (num_rings > MW_LOG_MAX_RINGS) num_rings = MW_LOG_MAX_RINGS;
+  for (i = 0; i < num_rings; i++) {
+    mw_ring_t *ring = __atomic_load_n(&log->rings[i], __ATOMIC_ACQUIRE);
+    uint64_t head, tail;
+
+    /* slot claimed but ring not yet published */
+    if (ring == NULL) continue;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    tail = ring->tail;
+    while (tail < head) {
+      uint64_t n = head - tail;
+      uint64_t off = tail & ring->mask;
+      /* copy a run that neither wraps the ring nor overfills the batch */
+      if (n > ring->mask + 1 - off) n = ring->mask + 1 - off;
+      if (n > MW_LOG_BATCH - log->batch_len) n = MW_LOG_BATCH - log->batch_len;
+      memcpy(&log->batch[log->batch_len], &ring->records[off], n * sizeof(mw_record_t));
+      log->batch_len += n;
+      tail += n;
+      drained += n;
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+      if (log->batch_len == MW_LOG_BATCH) flush_batch(log);
+    }
+  }
+  return drained;
+}
+
+/* writer thread: drain until told to stop, sleeping whenever idle */
+static void *writer_main(void *arg) {
+  mw_log_t *log = (mw_log_t *)arg;
+  struct timespec poll = { 0, MW_LOG_POLL_NSEC };
+
+  #if defined(__linux__)
+    if (log->writer_cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(log->writer_cpu, &set);
+      if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        fprintf(stderr, "%s:%d: WARNING: could not pin log writer to cpu %d\n", __FILE__, __LINE__, log->writer_cpu);
+      }
+    }
+  #endif
+
+  while (!__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE)) {
+    if (drain_rings(log) == 0) {
+      /* nothing new: write out any partial batch and back off */
+      flush_batch(log);
+      nanosleep(&poll, NULL);
+    }
+  }
+  return NULL;
+}
+
+mw_log_t *mw_log_open(const char *path, int writer_cpu) {
+  mw_log_header_t header;
+  mw_log_t *log = (mw_log_t *)calloc(1, sizeof(*log));
+
+  if (log == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating timing log.\n", __FILE__, __LINE__);
+    return NULL;
+  }
+
+  log->fp = fopen(path, "wb");
+  if (log->fp == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- could not open timing log %s.\n", __FILE__, __LINE__, path);
+    free(log);
+    return NULL;
+  }
+  log->writer_cpu = writer_cpu;
+
+  /* placeholder header; rewritten by mw_log_close() */
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MW_LOG_MAGIC, sizeof(header.magic));
+  header.version = MW_LOG_VERSION;
+  header.record_size = sizeof(mw_record_t);
+  fwrite(&header, sizeof(header), 1, log->fp);
+
+  /* reference points for the TSC rate */
+  log->open_nsec = now_nsec();
+  TSC_START_C(log->open_tsc)
+
+  if (pthread_create(&log->writer, NULL, writer_main, log) != 0) {
+    fprintf(stderr, "%s:%d: ERROR -- could not start log writer.\n", __FILE__, __LINE__);
+    fclose(log->fp);
+    free(log);
+    return NULL;
+  }
+  return log;
+}
+
+mw_ring_t *mw_log_ring(mw_log_t *log, uint64_t capacity) {
+  mw_ring_t *ring;
+  uint64_t cap = 1;
+  uint32_t id;
+
+  while (cap < capacity) cap <<= 1;
+
+  if (posix_memalign((void **)&ring, 64, sizeof(*ring)) != 0) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating timing ring.\n", __FILE__, __LINE__);
+    return NULL;
+  }
+  memset(ring, 0, sizeof(*ring));
+  if (posix_memalign((void **)&ring->records, 64, cap * sizeof(mw_record_t)) != 0) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating timing ring.\n", __FILE__, __LINE__);
+    free(ring);
+    return NULL;
+  }
+  /* touch the records now so page faults are not taken in the hot path */
+  memset(ring->records, 0, cap * sizeof(mw_record_t));
+  ring->mask = cap - 1;
+
+  /* claim a slot and publish the ring to the writer */
+  id = __atomic_fetch_add(&log->num_rings, 1, __ATOMIC_ACQ_REL);
+  if (id >= MW_LOG_MAX_RINGS) {
+    fprintf(stderr, "%s:%d: ERROR -- too many timing log rings (max %d).\n", __FILE__, __LINE__, MW_LOG_MAX_RINGS);
+    __atomic_fetch_sub(&log->num_rings, 1, __ATOMIC_ACQ_REL);
+    free(ring->records);
+    free(ring);
+    return NULL;
+  }
+  ring->thread = id;
+  __atomic_store_n(&log->rings[id], ring, __ATOMIC_RELEASE);
+  return ring;
+}
+
+int mw_log_close(mw_log_t *log) {
+  mw_log_header_t header;
+  mw_log_ring_t info;
+  uint64_t close_tsc, close_nsec, dropped = 0;
+  uint32_t i, num_rings;
+  int ret = 0;
+
+  TSC_START_C(close_tsc)
+  close_nsec = now_nsec();
+
+  /* stop the writer, then pick up anything it left behind */
+  __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(log->writer, NULL);
+  drain_rings(log);
+  flush_batch(log);
+
+  /* per-ring totals */
+  num_rings = 0;
+  for (i = 0; i < MW_LOG_MAX_RINGS; i++) {
+    mw_ring_t *ring = log->rings[i];
+    if (ring == NULL) continue;
+    num_rings++;
+    memset(&info, 0, sizeof(info));
+    info.thread = ring->thread;
+    info.records = ring->tail;
+    info.dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    dropped += info.dropped;
+    if (fwrite(&info, sizeof(info), 1, log->fp) != 1) log->write_error = 1;
+    free(ring->records);
+    free(ring);
+  }
+
+  /* final header */
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MW_LOG_MAGIC, sizeof(header.magic));
+  header.version = MW_LOG_VERSION;
+  header.record_size = sizeof(mw_record_t);
+  header.num_records = log->num_records;
+  header.num_dropped = dropped;
+  header.num_rings = num_rings;
+  if (close_nsec > log->open_nsec) {
+    header.tsc_per_nsec = (close_tsc - log->open_tsc) / (double)(close_nsec - log->open_nsec);
+  }
+  if (fseek(log->fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, log->fp) != 1) {
+    log->write_error = 1;
+  }
+
+  if (fclose(log->fp) != 0) log->write_error = 1;
+  if (log->write_error) {
+    fprintf(stderr, "%s:%d: ERROR -- timing log incomplete.\n", __FILE__, __LINE__);
+    ret = -1;
+  }
+  if (dropped > 0) {
+    fprintf(stderr, "%s:%d: WARNING: %llu timing records dropped (writer fell behind)\n", __FILE__, __LINE__, (unsigned long long)dropped);
+  }
+  free(log);
+  return ret;
+}
@@ -0,0 +1,149 @@
+/*****************************************************************************
+ *
+ * microwork_log.h
+ *
+ * Per-thread timing record rings drained to a binary log file by a
+ * background writer thread.
+ *
+ * Each measuring thread registers its own single-producer ring and
+ * pushes one fixed-size record per work invocation. Pushing does no
+ * syscalls and takes no locks; if the ring is full the record is
+ * counted as dropped instead of blocking. A writer thread (optionally
+ * pinned to a housekeeping cpu) drains all rings and writes the
+ * records in batches.
+ *
+ * Log file layout:
+ *
+ *   mw_log_header_t
+ *   mw_record_t      x header.num_records
+ *   mw_log_ring_t    x header.num_rings     (per-thread totals)
+ *
+ * The header is rewritten with the final counts when the log is closed.
+ *
+ *****************************************************************************/
+
+#if !defined( __MICROWORK_LOG_H_ )
+#define __MICROWORK_LOG_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MW_LOG_MAGIC "MWLOG01"
+#define MW_LOG_VERSION 1
+
+/* maximum number of producer rings per log */
+#define MW_LOG_MAX_RINGS 256
+
+/* records gathered by the writer before each write to the file */
+#define MW_LOG_BATCH 4096
+
+/* writer sleeps this long when it finds all rings empty */
+#define MW_LOG_POLL_NSEC 1000000
+
+/* one timing record */
+typedef struct mw_record_s {
+  uint64_t start_tsc;   /* TSC at start of work (before its start clock read) */
+  uint64_t end_tsc;     /* TSC at end of work (after its end clock read) */
+  uint64_t req_cycles;  /* requested loop_num (cycles for ASM, iterations for MXM) */
+  uint64_t target_nsec; /* requested duration */
+  uint16_t kernel;      /* work_kernel_t */
+  uint16_t cpu;         /* cpu the work finished on */
+  uint32_t thread;      /* ring (thread) id */
+} mw_record_t;
+
+/* file header */
+typedef struct mw_log_header_s {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;   /* sizeof(mw_record_t) */
+  uint64_t num_records;   /* records written */
+  uint64_t num_dropped;   /* records dropped because a ring was full */
+  uint32_t num_rings;     /* number of mw_log_ring_t entries after the records */
+  uint32_t reserved;
+  double tsc_per_nsec;    /* TSC rate measured between open and close */
+} mw_log_header_t;
+
+/* per-ring totals, written after the records */
+typedef struct mw_log_ring_s {
+  uint32_t thread;
+  uint32_t reserved;
+  uint64_t records;
+  uint64_t dropped;
+} mw_log_ring_t;
+
+/* single-producer ring; head and tail live on separate cache lines */
+typedef struct mw_ring_s {
+  mw_record_t *records;
+  uint64_t mask;          /* capacity - 1 (capacity is a power of two) */
+  uint32_t thread;
+  /* producer side */
+  uint64_t head __attribute__((aligned(64)));
+  uint64_t tail_cache;    /* producer's last view of tail */
+  uint64_t dropped;
+  /* consumer (writer) side */
+  uint64_t tail __attribute__((aligned(64)));
+} mw_ring_t;
+
+/* log state */
+typedef struct mw_log_s {
+  FILE *fp;
+  pthread_t writer;
+  int writer_cpu;         /* cpu the writer is pinned to, or -1 */
+  int stop;
+  uint32_t num_rings;
+  mw_ring_t *rings[MW_LOG_MAX_RINGS];
+  mw_record_t batch[MW_LOG_BATCH];
+  uint32_t batch_len;
+  uint64_t num_records;
+  int write_error;
+  uint64_t open_tsc;
+  uint64_t open_nsec;
+} mw_log_t;
+
+/* Open a log file and start the writer thread.
+ *
+ * path       : log file to create
+ * writer_cpu : cpu to pin the writer thread to; -1 to leave it unpinned
+ *
+ * Returns: log handle, or NULL on failure.
+ */
+mw_log_t *mw_log_open(const char *path, int writer_cpu);
+
+/* Create a ring for the calling thread. Not a hot-path call.
+ *
+ * log      : log the ring is drained into
+ * capacity : number of records; rounded up to a power of two
+ *
+ * Returns: ring, or NULL on failure.
+ */
+mw_ring_t *mw_log_ring(mw_log_t *log, uint64_t capacity);
+
+/* Stop the writer, drain all rings, and finalize the file.
+ * Rings belonging to the log are freed.
+ *
+ * Returns: 0 on success, -1 if any write failed.
+ */
+int mw_log_close(mw_log_t *log);
+
+/* Push one record onto a ring. Only the owning thread may push.
+ *
+ * Returns: 0 if queued, -1 if the ring was full and the record dropped.
+ */
+static inline int mw_ring_push(mw_ring_t *ring, const mw_record_t *rec) {
+  uint64_t head = ring->head;
+
+  if (head - ring->tail_cache > ring->mask) {
+    ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head - ring->tail_cache > ring->mask) {
+      __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+  }
+  ring->records[head & ring->mask] = *rec;
+  ring->records[head & ring->mask].thread = ring->thread;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+#endif /* __MICROWORK_LOG_H_ */
@@ -0,0 +1,173 @@
+/*****************************************************************************
+ *
+ * microwork_numa.c
+ *
+ * NUMA topology, node-bound work buffers, and per-node calibration.
+ * See microwork_numa.h.
+ *
+ *****************************************************************************/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "microwork_numa.h"
+
+#define SYSFS_NODE "/sys/devices/system/node"
+
+/* mbind(2) policy, as in <numaif.h>, so libnuma is not required */
+#define MW_MPOL_BIND 2
+
+/* first touch request for a helper thread */
+typedef struct touch_s {
+  uint64_t *buf;
+  uint64_t bytes;
+  int cpu;
+} touch_t;
+
+int mw_numa_read(mw_numa_t *numa) {
+  static int set[MW_MAX_CPUS];
+  char path[256], buf[4096];
+  int c, n;
+
+  memset(numa, 0, sizeof(*numa));
+  for (n = 0; n < MW_MAX_NODES; n++) numa->first_cpu[n] = -1;
+
+  if (mw_read_line(SYSFS_NODE "/online", buf, sizeof(buf)) == 0) {
+    mw_parse_cpulist(buf, set);   /* node lists use the cpu list format */
+    for (n = 0; n < MW_MAX_NODES; n++) numa->online[n] = set[n];
+  } else {
+    /* no NUMA information: one node */
+    numa->online[0] = 1;
+  }
+
+  if (mw_read_line(SYSFS_NODE "/has_memory", buf, sizeof(buf)) == 0) {
+    mw_parse_cpulist(buf, set);
+    for (n = 0; n < MW_MAX_NODES; n++) numa->has_memory[n] = set[n];
+  } else {
+    for (n = 0; n < MW_MAX_NODES; n++) numa->has_memory[n] = numa->online[n];
+  }
+
+  for (n = 0; n < MW_MAX_NODES; n++) {
+    if (!numa->online[n]) continue;
+    numa->num_nodes++;
+    snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", n);
+    if (mw_read_line(path, buf, sizeof(buf)) != 0) {
+      if (numa->num_nodes > 1) continue;
+      /* single node without a cpulist holds every cpu */
+      snprintf(buf, sizeof(buf), "0-%d", MW_MAX_CPUS - 1);
+    }
+    mw_parse_cpulist(buf, set);
+    for (c = 0; c < MW_MAX_CPUS; c++) {
+      if (!set[c]) continue;
+      numa->node_of_cpu[c] = n;
+      if (numa->first_cpu[n] < 0) numa->first_cpu[n] = c;
+    }
+  }
+
+  if (numa->num_nodes == 0) {
+    fprintf(stderr, "%s:%d: ERROR -- no online NUMA nodes found.\n", __FILE__, __LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+int mw_numa_pick_node(const mw_numa_t *numa, int cpu, numa_placement_t placement) {
+  int local = (cpu >= 0 && cpu < MW_MAX_CPUS) ? numa->node_of_cpu[cpu] : 0;
+  int i, n;
+
+  if (placement == NUMA_LOCAL) return local;
+
+  /* the next node after the local one that has memory */
+  for (i = 1; i < MW_MAX_NODES; i++) {
+    n = (local + i) % MW_MAX_NODES;
+    if (numa->online[n] && numa->has_memory[n]) return n;
+  }
+  fprintf(stderr, "%s:%d: WARNING: no remote NUMA node with memory; using local node %d\n", __FILE__, __LINE__, local);
+  return local;
+}
+
+/* first touch, from a thread pinned to the node */
+static void *touch_main(void *arg) {
+  touch_t *t = (touch_t *)arg;
+  if (t->cpu >= 0) mw_pin_self(t->cpu);
+  memset(t->buf, 0, t->bytes);
+  return NULL;
+}
+
+uint64_t *mw_numa_alloc(const mw_numa_t *numa, uint64_t bytes, int node) {
+  static int warned = 0;
+  uint64_t *buf;
+  pthread_t tid;
+  touch_t touch;
+
+  buf = (uint64_t *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating %llu byte buffer.\n", __FILE__, __LINE__, (unsigned long long)bytes);
+    return NULL;
+  }
+
+  #if defined(__linux__) && defined(SYS_mbind)
+    if (numa->num_nodes > 1) {
+      unsigned long mask[MW_MAX_NODES / (8 * sizeof(unsigned long)) + 1];
+      memset(mask, 0, sizeof(mask));
+      mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+      if (syscall(SYS_mbind, buf, bytes, MW_MPOL_BIND, mask, (unsigned long)(8 * sizeof(mask)), 0) != 0 && !warned) {
+        fprintf(stderr, "%s:%d: WARNING: mbind failed (errno %d); relying on first touch\n", __FILE__, __LINE__, errno);
+        warned = 1;
+      }
+    }
+  #endif
+
+  touch.buf = buf;
+  touch.bytes = bytes;
+  touch.cpu = (node >= 0 && node < MW_MAX_NODES) ? numa->first_cpu[node] : -1;
+  if (pthread_create(&tid, NULL, touch_main, &touch) != 0) {
+    touch_main(&touch);
+  } else {
+    pthread_join(tid, NULL);
+  }
+  return buf;
+}
+
+void mw_numa_free(uint64_t *buf, uint64_t bytes) {
+  if (buf != NULL) munmap(buf, bytes);
+}
+
+int mw_numa_calibrate(const mw_numa_t *numa, int cpu, uint64_t bytes, int num_trials, uint64_t min_loops,
+                      uint64_t cycles_per_trial, int num_points, rest_t rest_type, int verbose, mw_numa_cal_t *cal) {
+  uint64_t *buf;
+  int n, count = 0;
+
+  memset(cal, 0, sizeof(*cal));
+  cal->cpu = cpu;
+  if (mw_pin_self(cpu) != 0) {
+    fprintf(stderr, "%s:%d: WARNING: could not pin calibration to cpu %d\n", __FILE__, __LINE__, cpu);
+  }
+
+  for (n = 0; n < MW_MAX_NODES; n++) {
+    if (!numa->online[n] || !numa->has_memory[n]) continue;
+    buf = mw_numa_alloc(numa, bytes, n);
+    if (buf == NULL) continue;
+    if (set_work_buffer(buf, bytes) != 0) {
+      mw_numa_free(buf, bytes);
+      break;
+    }
+    if (verbose) printf("Calibrating with work buffer on node %d:\n", n);
+    if (num_points > 1) {
+      calibrate_regression(num_trials, min_loops, cycles_per_trial, num_points, rest_type, verbose, &cal->results[n]);
+    } else {
+      calibrate(num_trials, cycles_per_trial, rest_type, verbose, &cal->results[n]);
+    }
+    cal->valid[n] = 1;
+    count++;
+    set_work_buffer(NULL, 0);
+    mw_numa_free(buf, bytes);
+  }
+  return count;
+}
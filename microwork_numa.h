@@ -0,0 +1,81 @@
+/*****************************************************************************
+ *
+ * microwork_numa.h
+ *
+ * NUMA topology, node-bound work buffers, and per-node calibration.
+ *
+ * Buffers are bound to a node with mbind(MPOL_BIND) and then first
+ * touched by a thread pinned to a cpu of that node, so placement holds
+ * even where mbind is unavailable. A worker asks for its buffer to be
+ * NUMA_LOCAL (its own node) or NUMA_REMOTE (another node with memory);
+ * on a single-node host remote degrades to local with a warning.
+ *
+ * Per-node calibration times the work loop from one cpu with the work
+ * buffer on each node in turn, so a worker uses the record for the node
+ * its buffer is on, and the cross-node penalty can be modeled on
+ * purpose. Only memory-touching loops (WORK_MEM) see a difference.
+ *
+ *****************************************************************************/
+
+#if !defined( __MICROWORK_NUMA_H_ )
+#define __MICROWORK_NUMA_H_
+
+#include "microwork_inline.h"
+#include "microwork_interfere.h"
+
+/* largest node number handled */
+#define MW_MAX_NODES 64
+
+/* where a worker's buffer goes relative to the worker */
+typedef enum numa_placement_e { NUMA_LOCAL, NUMA_REMOTE } numa_placement_t;
+
+/* NUMA topology, from /sys/devices/system/node */
+typedef struct mw_numa_s {
+  int num_nodes;                    /* number of online nodes */
+  int online[MW_MAX_NODES];
+  int has_memory[MW_MAX_NODES];
+  int first_cpu[MW_MAX_NODES];      /* lowest cpu of each node, or -1 */
+  int node_of_cpu[MW_MAX_CPUS];
+} mw_numa_t;
+
+/* per-node calibration records */
+typedef struct mw_numa_cal_s {
+  int cpu;                          /* cpu the calibration ran on */
+  int valid[MW_MAX_NODES];          /* 1 if results[node] was calibrated */
+  c_results_t results[MW_MAX_NODES];
+} mw_numa_cal_t;
+
+/* Read the NUMA topology. Hosts without /sys/devices/system/node are
+ * treated as a single node holding every cpu.
+ *
+ * Returns: 0 on success, -1 on failure.
+ */
+int mw_numa_read(mw_numa_t *numa);
+
+/* Choose the node for a buffer used by a worker on cpu.
+ *
+ * Returns: node number.
+ */
+int mw_numa_pick_node(const mw_numa_t *numa, int cpu, numa_placement_t placement);
+
+/* Allocate a buffer bound to a node and first touch it from that node.
+ *
+ * Returns: 64 byte aligned buffer, or NULL on failure.
+ */
+uint64_t *mw_numa_alloc(const mw_numa_t *numa, uint64_t bytes, int node);
+
+/* Free a buffer from mw_numa_alloc(). */
+void mw_numa_free(uint64_t *buf, uint64_t bytes);
+
+/* Calibrate the work loop on cpu once per node with memory, with a
+ * bytes sized work buffer on that node. With num_points > 1 each node
+ * uses calibrate_regression() between min_loops and cycles_per_trial,
+ * otherwise calibrate(), which ignores min_loops. Remaining arguments
+ * are as for those. The work buffer is left unset afterwards.
+ *
+ * Returns: number of nodes calibrated.
+ */
+int mw_numa_calibrate(const mw_numa_t *numa, int cpu, uint64_t bytes, int num_trials, uint64_t min_loops,
+                      uint64_t cycles_per_trial, int num_points, rest_t rest_type, int verbose, mw_numa_cal_t *cal);
+
+#endif /* __MICROWORK_NUMA_H_ */
@@ -0,0 +1,281 @@
+/*****************************************************************************
+ *
+ * microwork_region.c
+ *
+ * Region profiler. See microwork_region.h.
+ *
+ *****************************************************************************/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "microwork_region.h"
+
+/* shortest interval used to measure the TSC rate at export */
+#define MIN_RATE_NSEC 50000000
+
+__thread mw_region_thread_t *mw_region_self = NULL;
+uint64_t mw_region_unattached = 0;
+
+static uint64_t region_capacity = MW_REGION_CAPACITY_DEFAULT;
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+static uint64_t init_tsc, init_nsec;
+
+/* registry; only registration takes the lock, and publishes each 
+   region by storing mw_region_num with release ordering */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static char region_names[MW_REGION_MAX_REGIONS][MW_REGION_NAME_MAX];
+static dag_kernel_t region_kernels[MW_REGION_MAX_REGIONS];
+int mw_region_num = 0;
+
+/* every thread that has recorded, newest first */
+static mw_region_thread_t *thread_list = NULL;
+static int num_threads = 0;
+
+static uint64_t clock_nsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void init_clock() {
+  init_nsec = clock_nsec();
+  TSC_START_C(init_tsc)
+}
+
+void mw_region_init(uint64_t capacity) {
+  if (capacity > 0) region_capacity = capacity;
+  pthread_once(&clock_once, init_clock);
+}
+
+int mw_region_register(const char *name, dag_kernel_t kernel) {
+  char token[MW_REGION_NAME_MAX];
+  int i, id = -1;
+
+  /* names are single tokens in the exported files; look up by the token */
+  snprintf(token, sizeof(token), "%s", name);
+  for (i = 0; token[i] != '\0'; i++) {
+    if (token[i] == ' ' || token[i] == '\t' || token[i] == '#') token[i] = '_';
+  }
+
+  pthread_once(&clock_once, init_clock);
+  pthread_mutex_lock(&registry_lock);
+  for (i = 0; i < mw_region_num; i++) {
+    if (strcmp(region_names[i], token) == 0) {
+      id = i;
+      break;
+    }
+  }
+  if (id < 0 && mw_region_num < MW_REGION_MAX_REGIONS) {
+    id = mw_region_num;
+    strcpy(region_names[id], token);
+    region_kernels[id] = kernel;
+    __atomic_store_n(&mw_region_num, id + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&registry_lock);
+
+  if (id < 0) {
+    fprintf(stderr, "%s:%d: ERROR -- more than %d regions registered.\n", __FILE__, __LINE__, MW_REGION_MAX_REGIONS);
+  }
+  return id;
+}
+
+mw_region_thread_t *mw_region_attach() {
+  mw_region_thread_t *r;
+
+  if (mw_region_self != NULL) return mw_region_self;
+  pthread_once(&clock_once, init_clock);
+  r = (mw_region_thread_t *)calloc(1, sizeof(*r));
+  if (r != NULL) r->recs = (mw_region_rec_t *)malloc(region_capacity * sizeof(*r->recs));
+  if (r == NULL || r->recs == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating region buffer.\n", __FILE__, __LINE__);
+    free(r);
+    return NULL;
+  }
+  /* pre-fault the buffer so the first records do not pay for it */
+  memset(r->recs, 0, region_capacity * sizeof(*r->recs));
+  r->capacity = region_capacity;
+  r->thread = __atomic_fetch_add(&num_threads, 1, __ATOMIC_RELAXED);
+
+  /* push onto the thread list */
+  r->next = __atomic_load_n(&thread_list, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&thread_list, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  mw_region_self = r;
+  return r;
+}
+
+/*****************************************************************************
+ * EXPORT
+ *****************************************************************************/
+
+/* TSC ticks per nsec since init */
+static double tsc_rate() {
+  struct timespec pause;
+  uint64_t tsc, nsec;
+
+  pthread_once(&clock_once, init_clock);
+  nsec = clock_nsec();
+  if (nsec - init_nsec < MIN_RATE_NSEC) {
+    pause.tv_sec = 0;
+    pause.tv_nsec = MIN_RATE_NSEC - (nsec - init_nsec);
+    nanosleep(&pause, NULL);
+    nsec = clock_nsec();
+  }
+  TSC_START_C(tsc)
+  return (tsc - init_tsc) / (double)(nsec - init_nsec);
+}
+
+/* recorded threads in order of first use; caller frees */
+static mw_region_thread_t **threads_in_order(int *n) {
+  mw_region_thread_t *head = __atomic_load_n(&thread_list, __ATOMIC_ACQUIRE), *r, **threads;
+  int count = 0;
+
+  for (r = head; r != NULL; r = r->next) count++;
+  threads = (mw_region_thread_t **)calloc(count > 0 ? count : 1, sizeof(*threads));
+  if (threads == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating thread list.\n", __FILE__, __LINE__);
+    *n = 0;
+    return NULL;
+  }
+  /* the list is newest first */
+  *n = count;
+  for (r = head; r != NULL; r = r->next) threads[--count] = r;
+  return threads;
+}
+
+void mw_region_export_hist(FILE *out) {
+  static const char *kernel_names[] = DAG_KERNEL_NAMES;
+  mw_region_thread_t **threads;
+  uint64_t *nsec, total, buckets[64], i, n;
+  double rate;
+  int num, t, g, b;
+  int num_regions = __atomic_load_n(&mw_region_num, __ATOMIC_ACQUIRE);
+
+  rate = tsc_rate();
+  threads = threads_in_order(&num);
+  if (threads == NULL) return;
+
+  for (g = 0; g < num_regions; g++) {
+    /* gather this region's durations */
+    n = 0;
+    for (t = 0; t < num; t++) {
+      for (i = 0; i < __atomic_load_n(&threads[t]->count, __ATOMIC_ACQUIRE); i++) n += threads[t]->recs[i].region == (uint32_t)g;
+    }
+    if (n == 0) continue;
+    nsec = (uint64_t *)malloc(n * sizeof(*nsec));
+    if (nsec == NULL) {
+      fprintf(stderr, "%s:%d: ERROR -- failure allocating durations.\n", __FILE__, __LINE__);
+      break;
+    }
+    n = 0;
+    for (t = 0; t < num; t++) {
+      mw_region_thread_t *r = threads[t];
+      for (i = 0; i < __atomic_load_n(&r->count, __ATOMIC_ACQUIRE); i++) {
+        if (r->recs[i].region == (uint32_t)g) nsec[n++] = (uint64_t)((r->recs[i].end_tsc - r->recs[i].start_tsc) / rate);
+      }
+    }
+    qsort(nsec, n, sizeof(*nsec), mw_cmp_u64);
+
+    total = 0;
+    memset(buckets, 0, sizeof(buckets));
+    for (i = 0; i < n; i++) {
+      total += nsec[i];
+      b = nsec[i] > 0 ? 63 - __builtin_clzll(nsec[i]) : 0;
+      buckets[b]++;
+    }
+
+    fprintf(out, "region %s %s %llu %llu %llu %llu %llu %llu %.1f\n", region_names[g], kernel_names[region_kernels[g]],
+        (unsigned long long)n, (unsigned long long)total, (unsigned long long)nsec[0],
+        (unsigned long long)nsec[n / 2], (unsigned long long)nsec[(n * 99) / 100],
+        (unsigned long long)nsec[n - 1], total / (double)n);
+    for (b = 0; b < 64; b++) {
+      if (buckets[b] == 0) continue;
+      fprintf(out, "bucket %s %llu %llu %llu\n", region_names[g], b == 0 ? 0ULL : 1ULL << b,
+          b == 63 ? ~0ULL : (1ULL << (b + 1)) - 1, (unsigned long long)buckets[b]);
+    }
+    free(nsec);
+  }
+  free(threads);
+}
+
+void mw_region_export_seq(FILE *out) {
+  mw_region_thread_t **threads;
+  mw_region_rec_t *rec;
+  double rate;
+  uint64_t i;
+  int num, t;
+  int num_regions = __atomic_load_n(&mw_region_num, __ATOMIC_ACQUIRE);
+
+  rate = tsc_rate();
+  threads = threads_in_order(&num);
+  if (threads == NULL) return;
+
+  for (t = 0; t < num; t++) {
+    for (i = 0; i < __atomic_load_n(&threads[t]->count, __ATOMIC_ACQUIRE); i++) {
+      rec = &threads[t]->recs[i];
+      if (rec->region >= (uint32_t)num_regions) continue;
+      fprintf(out, "seq %d %s %u %llu %llu\n", threads[t]->thread, region_names[rec->region], rec->depth,
+          (unsigned long long)((rec->start_tsc - init_tsc) / rate),
+          (unsigned long long)((rec->end_tsc - rec->start_tsc) / rate));
+    }
+  }
+  free(threads);
+}
+
+int mw_region_export_dag(FILE *out, int with_gaps) {
+  static const char *kernel_names[] = DAG_KERNEL_NAMES;
+  mw_region_thread_t **threads;
+  mw_region_rec_t *rec;
+  uint64_t i, prev_end;
+  double rate;
+  int num, t, id = 0, prev;
+  int num_regions = __atomic_load_n(&mw_region_num, __ATOMIC_ACQUIRE);
+
+  rate = tsc_rate();
+  threads = threads_in_order(&num);
+  if (threads == NULL) return 0;
+
+  fprintf(out, "# task graph from %d profiled threads\n", num);
+  for (t = 0; t < num; t++) {
+    fprintf(out, "# thread %d\n", threads[t]->thread);
+    prev = -1;
+    prev_end = 0;
+    /* outermost regions end in the order they run */
+    for (i = 0; i < __atomic_load_n(&threads[t]->count, __ATOMIC_ACQUIRE); i++) {
+      rec = &threads[t]->recs[i];
+      /* ids never registered have no name or kernel */
+      if (rec->depth != 0 || rec->region >= (uint32_t)num_regions) continue;
+      if (with_gaps && prev >= 0 && rec->start_tsc > prev_end) {
+        fprintf(out, "task %d work fixed %llu  # gap\n", id, (unsigned long long)((rec->start_tsc - prev_end) / rate));
+        fprintf(out, "edge %d %d\n", prev, id);
+        prev = id++;
+      }
+      fprintf(out, "task %d %s fixed %llu  # %s\n", id, kernel_names[region_kernels[rec->region]],
+          (unsigned long long)((rec->end_tsc - rec->start_tsc) / rate), region_names[rec->region]);
+      if (prev >= 0) fprintf(out, "edge %d %d\n", prev, id);
+      prev = id++;
+      prev_end = rec->end_tsc;
+    }
+  }
+  free(threads);
+  return id;
+}
+
+void mw_region_summary(FILE *out) {
+  mw_region_thread_t **threads;
+  int num, t;
+
+  threads = threads_in_order(&num);
+  if (threads == NULL) return;
+  fprintf(out, "# thread # records # dropped # mismatched # open #\n");
+  for (t = 0; t < num; t++) {
+    fprintf(out, "%d\t%llu\t%llu\t%llu\t%d\n", threads[t]->thread, (unsigned long long)threads[t]->count,
+        (unsigned long long)threads[t]->dropped, (unsigned long long)threads[t]->mismatched, threads[t]->depth);
+  }
+  fprintf(out, "# regions begun by unattached threads : %llu\n",
+      (unsigned long long)__atomic_load_n(&mw_region_unattached, __ATOMIC_RELAXED));
+  free(threads);
+}
@@ -0,0 +1,201 @@
+/*****************************************************************************
+ *
+ * microwork_region.h
+ *
+ * Region profiler: begin/end markers that record the real durations of
+ * an application's compute phases, so they can be replayed with the
+ * work loops.
+ *
+ * Regions are registered once by name, each recording thread attaches
+ * once, and the regions are then bracketed:
+ *
+ *   int solve = mw_region_register("solve", DAG_WORK);
+ *   ...
+ *   mw_region_attach();          (in each thread, outside measured code)
+ *   ...
+ *   MW_REGION_BEGIN(solve);
+ *   ... phase ...
+ *   MW_REGION_END(solve);
+ *
+ * The markers read the TSC with TSC_START_C/TSC_END_C and append a
+ * record to a fixed-size buffer owned by the calling thread, with no
+ * locks or shared writes; records past the buffer's capacity are
+ * counted as dropped. Regions nest up to MW_REGION_MAX_DEPTH deep.
+ * Regions of a thread that has not attached, and ids not returned by
+ * mw_region_register, are not recorded. The markers compile to nothing
+ * unless MW_REGION_PROFILE is defined, so the same source builds with
+ * and without instrumentation.
+ *
+ * After the instrumented threads are done, the records are exported as:
+ *   - histograms: per-region count, percentiles and log2 buckets of nsecs
+ *   - sequences : every record, per thread, in order
+ *   - a task graph for microwork_dag.h: each thread's outermost regions
+ *     as a chain of tasks of the recorded durations, with the region's
+ *     kernel, so mwd_*.x -f replays the application as a skeleton
+ *
+ *****************************************************************************/
+
+#if !defined( __MICROWORK_REGION_H_ )
+#define __MICROWORK_REGION_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "microwork_inline_work.h"
+#include "microwork_dag.h"
+
+/* most regions registered */
+#define MW_REGION_MAX_REGIONS 256
+
+/* longest region name */
+#define MW_REGION_NAME_MAX 64
+
+/* deepest nesting recorded; deeper regions are counted, not recorded */
+#define MW_REGION_MAX_DEPTH 32
+
+/* records per thread if mw_region_init is not called */
+#define MW_REGION_CAPACITY_DEFAULT (1 << 20)
+
+/* one completed region */
+typedef struct mw_region_rec_s {
+  uint64_t start_tsc;
+  uint64_t end_tsc;
+  uint32_t region;
+  uint32_t depth;           /* 0 for an outermost region */
+} mw_region_rec_t;
+
+/* an open region */
+typedef struct mw_region_frame_s {
+  uint64_t start_tsc;
+  uint32_t region;
+} mw_region_frame_t;
+
+/* per-thread recording state; written only by its thread */
+typedef struct mw_region_thread_s {
+  int thread;               /* order of first use */
+  int depth;                /* open regions, including unrecorded ones */
+  uint64_t count;           /* records written */
+  uint64_t capacity;
+  uint64_t dropped;         /* records lost to a full buffer or depth */
+  uint64_t mismatched;      /* ends whose id did not match the open region */
+  mw_region_frame_t stack[MW_REGION_MAX_DEPTH];
+  mw_region_rec_t *recs;
+  struct mw_region_thread_s *next;
+} mw_region_thread_t;
+
+/* calling thread's state, NULL until it attaches */
+extern __thread mw_region_thread_t *mw_region_self;
+
+/* regions begun by threads that had not attached */
+extern uint64_t mw_region_unattached;
+
+/* regions registered; ids below it are valid. Written with release 
+   ordering after the region's name and kernel */
+extern int mw_region_num;
+
+/* Set the per-thread record capacity and start the clock used to convert
+ * TSC ticks to nsecs. Call before any region, from one thread.
+ */
+void mw_region_init(uint64_t capacity);
+
+/* Register a region, or look up one already registered under name.
+ *
+ * kernel : kernel its tasks get in an exported task graph
+ *
+ * Returns: region id, or -1 if MW_REGION_MAX_REGIONS are registered.
+ */
+int mw_region_register(const char *name, dag_kernel_t kernel);
+
+/* Allocate and pre-fault the calling thread's buffer. Call once in each
+ * recording thread before its first region, outside measured code; a
+ * second call returns the same buffer.
+ *
+ * Returns: the thread's state, or NULL if it could not be allocated.
+ */
+mw_region_thread_t *mw_region_attach();
+
+static inline void mw_region_begin(uint32_t region) {
+  mw_region_thread_t *r = mw_region_self;
+
+  if (r == NULL) {
+    __atomic_fetch_add(&mw_region_unattached, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  if (region >= (uint32_t)__atomic_load_n(&mw_region_num, __ATOMIC_ACQUIRE)) return;
+  if (r->depth < MW_REGION_MAX_DEPTH) {
+    r->stack[r->depth].region = region;
+    TSC_START_C(r->stack[r->depth].start_tsc)
+  }
+  r->depth++;
+}
+
+static inline void mw_region_end(uint32_t region) {
+  mw_region_thread_t *r = mw_region_self;
+  mw_region_rec_t *rec;
+  uint64_t end;
+  uint32_t aux;
+
+  /* cheap checks first; a dropped end does not pay for the TSC read */
+  if (r == NULL || r->depth == 0) return;
+  if (region >= (uint32_t)__atomic_load_n(&mw_region_num, __ATOMIC_ACQUIRE)) return;
+  r->depth--;
+  if (r->depth >= MW_REGION_MAX_DEPTH || r->count >= r->capacity) {
+    r->dropped++;
+    return;
+  }
+  TSC_END_C(end, aux)
+  (void)aux;
+  if (r->stack[r->depth].region != region) r->mismatched++;
+  rec = &r->recs[r->count];
+  rec->start_tsc = r->stack[r->depth].start_tsc;
+  rec->end_tsc = end;
+  rec->region = r->stack[r->depth].region;
+  rec->depth = r->depth;
+  __atomic_store_n(&r->count, r->count + 1, __ATOMIC_RELEASE);
+}
+
+#if defined( MW_REGION_PROFILE )
+  #define MW_REGION_BEGIN(_id) mw_region_begin(_id)
+  #define MW_REGION_END(_id)   mw_region_end(_id)
+#else
+  #define MW_REGION_BEGIN(_id)
+  #define MW_REGION_END(_id)
+#endif
+
+/* The export functions read every thread's buffer and must run after
+ * the instrumented threads have stopped recording.
+ */
+
+/* Write per-region histograms:
+ *
+ *   region <name> <kernel> <count> <total> <min> <p50> <p99> <max> <mean>
+ *   bucket <name> <lo> <hi> <count>      (one per non-empty log2 bucket)
+ *
+ * All durations in nsecs.
+ */
+void mw_region_export_hist(FILE *out);
+
+/* Write every record, one per line, per thread in the order the
+ * regions ended:
+ *
+ *   seq <thread> <name> <depth> <start> <nsec>
+ *
+ * start is nsecs since mw_region_init.
+ */
+void mw_region_export_seq(FILE *out);
+
+/* Write a task graph (microwork_dag.h format): for each thread, its
+ * outermost regions in order, as tasks with fixed durations chained by
+ * edges. Threads are independent chains. If with_gaps, the time between
+ * consecutive regions of a thread becomes a work task as well.
+ *
+ * Returns: number of tasks written.
+ */
+int mw_region_export_dag(FILE *out, int with_gaps);
+
+/* Print record, drop and mismatch counts per thread, and the regions
+ * begun by threads that had not attached.
+ */
+void mw_region_summary(FILE *out);
+
+#endif /* __MICROWORK_REGION_H_ */
@@ -0,0 +1,217 @@
+/*****************************************************************************
+ *
+ * microwork_region_test.c
+ *
+ * Exercises the region profiler (microwork_region.h) on a synthetic
+ * application whose phase durations are known: each of num_threads
+ * threads runs num_iters iterations of
+ *
+ *   compute : work loop, target_nsec, containing
+ *     inner : work loop, target_nsec / 2
+ *   io      : hybrid wait, 2 * target_nsec
+ *   empty   : nothing (the cost of a marker pair)
+ *
+ * and the recorded durations are printed as histograms next to the
+ * requested ones. With -o, the sequences and a task graph are written to
+ * <prefix>.seq and <prefix>.dag; mwd_*.x -f <prefix>.dag replays the
+ * application from the recording.
+ *
+ *****************************************************************************/
+
+#include "microwork_inline.h"
+#include "microwork_hybrid.h"
+#include "microwork_region.h"
+
+/* runtime options */
+typedef struct region_opts_s {
+  uint64_t cycles_per_trial;
+  int num_trials;
+  int rest_mode;
+  uint64_t target_nsec;
+  int num_iters;
+  int num_threads;
+  char *out_prefix;           /* NULL: histograms only */
+  int with_gaps;
+  int verbose;
+} region_opts_t;
+
+/* what each application thread needs */
+typedef struct app_s {
+  const region_opts_t *opts;
+  const mw_hybrid_t *hybrid;
+  uint64_t compute_loops;     /* loops for the part of compute outside inner */
+  uint64_t inner_loops;
+  int compute, inner, io, empty;
+} app_t;
+
+void usage(char **argv) {
+  printf("\n################################################################\n");
+  printf("Usage:\n");
+  printf("  %s -c <cycles> -t <trials> -r <rest_mode> -d <nsecs> -n <iters> [-j <threads>] [-o <prefix> [-g]] -v\n", argv[0]);
+  printf("\nWhere:\n");
+  printf("  -c <cycles>  : number of cycles per calibration trial (required)\n");
+  printf("  -t <trials>  : number of calibration trials (required)\n");
+  printf("  -r <int>     : rest mode for between calibration trials (required)\n");
+  printf("                  0 = sleep(1)\n");
+  printf("                  1 = write to /dev/null\n");
+  printf("  -d <nsecs>   : duration of the compute phase (required)\n");
+  printf("  -n <iters>   : iterations per thread (required)\n");
+  printf("  -j <threads> : application threads (optional; default 1)\n");
+  printf("  -o <prefix>  : write <prefix>.seq and <prefix>.dag (optional)\n");
+  printf("  -g           : include the time between regions in <prefix>.dag (optional)\n");
+  printf("  -v           : verbose (optional)\n");
+  printf("################################################################");
+  printf("\n");
+  exit(-1);
+}
+
+int process_args(int argc, char **argv, region_opts_t *opts) {
+  int c;
+  extern char *optarg;
+  extern int optopt;
+  int c_flag = 0, d_flag = 0, n_flag = 0, r_flag = 0, t_flag = 0;
+
+  opts->cycles_per_trial = 0;
+  opts->num_trials = 0;
+  opts->rest_mode = 0;
+  opts->target_nsec = 0;
+  opts->num_iters = 0;
+  opts->num_threads = 1;
+  opts->out_prefix = NULL;
+  opts->with_gaps = 0;
+  opts->verbose = 0;
+
+  while ((c = getopt(argc, argv, "c:d:gj:n:o:r:t:v")) != -1) {
+    switch(c)
+    {
+      case 'c': c_flag = 1; opts->cycles_per_trial = strtoull(optarg,NULL,10); break;
+      case 'd': d_flag = 1; opts->target_nsec = strtoull(optarg,NULL,10); break;
+      case 'g': opts->with_gaps = 1; break;
+      case 'j': opts->num_threads = atoi(optarg); break;
+      case 'n': n_flag = 1; opts->num_iters = atoi(optarg); break;
+      case 'o': opts->out_prefix = optarg; break;
+      case 'r': r_flag = 1; opts->rest_mode = atoi(optarg); break;
+      case 't': t_flag = 1; opts->num_trials = atoi(optarg); break;
+      case 'v': opts->verbose = 1; break;
+      case '?':
+        fprintf(stderr, "Unkown option -%c\n", optopt);
+        usage(argv);
+        break;
+      default:
+        usage(argv);
+        break;
+    }
+  }
+
+  if (!c_flag || !d_flag || !n_flag || !r_flag || !t_flag) {
+    fprintf(stderr, "\n-c, -d, -n, -r and -t options required\n");
+    usage(argv);
+  }
+  if (opts->num_threads < 1 || opts->num_iters < 1) usage(argv);
+  return 0;
+}
+
+/* one application thread */
+static void *app_main(void *arg) {
+  app_t *app = (app_t *)arg;
+  int i;
+
+  /* allocate the record buffer before the first marker */
+  if (mw_region_attach() == NULL) return NULL;
+  for (i = 0; i < app->opts->num_iters; i++) {
+    MW_REGION_BEGIN(app->compute);
+      timed_work(app->compute_loops);
+      MW_REGION_BEGIN(app->inner);
+        timed_work(app->inner_loops);
+      MW_REGION_END(app->inner);
+    MW_REGION_END(app->compute);
+
+    MW_REGION_BEGIN(app->io);
+      mw_hybrid_wait(app->hybrid, 2 * app->opts->target_nsec, NULL);
+    MW_REGION_END(app->io);
+
+    MW_REGION_BEGIN(app->empty);
+    MW_REGION_END(app->empty);
+  }
+  return NULL;
+}
+
+/* open <prefix><suffix> for writing */
+static FILE *open_out(const char *prefix, const char *suffix) {
+  char path[4096];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s%s", prefix, suffix);
+  fp = fopen(path, "w");
+  if (fp == NULL) fprintf(stderr, "%s:%d: ERROR -- could not open %s.\n", __FILE__, __LINE__, path);
+  return fp;
+}
+
+/*
+ * Mr. Main
+ */
+int main(int argc, char **argv) {
+  static const char *kernel_names[] = WORK_KERNEL_NAMES;
+  region_opts_t options;
+  mw_hybrid_t hybrid;
+  c_results_t c_results;
+  pthread_t *threads;
+  app_t app;
+  FILE *fp;
+  int i;
+
+  process_args(argc, argv, &options);
+
+  if (options.verbose) printf("Calibrating:\n");
+  calibrate(options.num_trials, options.cycles_per_trial, options.rest_mode, options.verbose, &c_results);
+  if (mw_hybrid_init(&hybrid, 0, 0) != 0) return -1;
+
+  mw_region_init(4 * options.num_iters);
+  app.opts = &options;
+  app.hybrid = &hybrid;
+  app.compute_loops = calc_loop_num(options.target_nsec / 2, &c_results);
+  app.inner_loops = calc_loop_num(options.target_nsec / 2, &c_results);
+  app.compute = mw_region_register("compute", DAG_WORK);
+  app.inner = mw_region_register("inner", DAG_WORK);
+  app.io = mw_region_register("io", DAG_WAIT);
+  app.empty = mw_region_register("empty", DAG_WORK);
+
+  threads = (pthread_t *)malloc(options.num_threads * sizeof(*threads));
+  if (threads == NULL) {
+    fprintf(stderr, "%s:%d: ERROR -- failure allocating threads.\n", __FILE__, __LINE__);
+    return -1;
+  }
+  for (i = 0; i < options.num_threads; i++) {
+    if (pthread_create(&threads[i], NULL, app_main, &app) != 0) {
+      fprintf(stderr, "%s:%d: ERROR -- failure creating thread %d.\n", __FILE__, __LINE__, i);
+      return -1;
+    }
+  }
+  for (i = 0; i < options.num_threads; i++) pthread_join(threads[i], NULL);
+  free(threads);
+
+  fprintf(stdout,"#############################################\n");
+  fprintf(stdout,"# work loop         : %s\n", kernel_names[WORK_KERNEL]);
+  fprintf(stdout,"# threads           : %d\n", options.num_threads);
+  fprintf(stdout,"# iterations        : %d\n", options.num_iters);
+  fprintf(stdout,"# requested compute : %lld\n", options.target_nsec);
+  fprintf(stdout,"# requested inner   : %lld\n", options.target_nsec / 2);
+  fprintf(stdout,"# requested io      : %lld\n", 2 * options.target_nsec);
+  fprintf(stdout,"#############################################\n");
+  mw_region_summary(stdout);
+  fprintf(stdout,"# region # kernel # count # total # min # p50 # p99 # max # mean #\n");
+  mw_region_export_hist(stdout);
+
+  if (options.out_prefix != NULL) {
+    if ((fp = open_out(options.out_prefix, ".seq")) != NULL) {
+      mw_region_export_seq(fp);
+      fclose(fp);
+    }
+    if ((fp = open_out(options.out_prefix, ".dag")) != NULL) {
+      i = mw_region_export_dag(fp, options.with_gaps);
+      fclose(fp);
+      fprintf(stdout, "# wrote %s.dag: %d tasks\n", options.out_prefix, i);
+    }
+  }
+  return 0;
+}